@@ -90,6 +90,8 @@ void ioapic_unmask_irq(uint8_t irq);
 
 void apic_setup_irq(uint8_t irq, uint8_t vector, bool mask, uint32_t flags);
 void apic_timer_calibrate(void);
+void apic_timer_periodic(void);
+void apic_timer_oneshot_ns(uint64_t ns);
 
 uint64_t hpet_read_counter(void);
 uint64_t hpet_get_frequency(void);
@@ -102,6 +104,7 @@ extern uintptr_t lapic_base;
 extern uintptr_t ioapic_base;
 extern uintptr_t hpet_base;
 extern uint32_t hpet_period;
+extern uint32_t apic_timer_period;
 extern uint64_t g_hpet_boot_counter;
 
 void ipi_reschedule_all(void);
@@ -109,5 +112,7 @@ void ipi_reschedule_cpu(uint32_t lapic_id);
 void ipi_reschedule_single(uint32_t target_lapic_id);
 void ipi_tlb_shootdown_broadcast(const uintptr_t* addrs, size_t count);
 void ipi_tlb_shootdown_single(uint32_t target_lapic_id, uintptr_t addr);
+void ipi_tlb_shootdown_mask(const volatile uint64_t* mask, size_t words, uintptr_t addr);
+void tlb_shootdown_service(uint32_t lapic_id);
 
 #endif
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include "../sched/wait.h"
 
 #define PS2_DATA_PORT           0x60
 #define PS2_STATUS_PORT         0x64
@@ -88,4 +89,6 @@ bool  kb_buf_try_getc(char *out);
 bool  kb_buf_has_ctrlc(void);
 void  kb_buf_consume_ctrlc(void);
 
+extern wait_queue_t kb_wait_queue;
+
 #endif
\ No newline at end of file
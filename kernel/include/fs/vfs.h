@@ -5,11 +5,11 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include "../syscall/errno.h"
+#include "../sched/spinlock.h"
 
 #define VFS_MAX_PATH        512
 #define VFS_MAX_NAME        256
 #define VFS_MAX_MOUNTS       16
-#define VFS_MAX_OPEN_FILES  512
 
 #define O_RDONLY    0x000
 #define O_WRONLY    0x001
@@ -112,7 +112,9 @@ typedef struct {
 typedef struct fd_table fd_table_t;
 
 struct fd_table {
-    fd_entry_t entries[TASK_MAX_FDS];
+    fd_entry_t   entries[TASK_MAX_FDS];
+    volatile int refcount;
+    spinlock_t   lock;
 };
 
 void    vfs_init   (void);
@@ -136,18 +138,21 @@ int64_t vfs_ioctl  (vfs_file_t *file, uint64_t req, void *arg);
 int     vfs_readdir(vfs_file_t *file, vfs_dirent_t *out);
 int     vfs_mkdir  (const char *path, uint32_t mode);
 
+vnode_t    *vnode_alloc  (void);
+void        vnode_free   (vnode_t *node);
 void        vnode_ref    (vnode_t *node);
 void        vnode_unref  (vnode_t *node);
 vfs_file_t *vfs_file_alloc(void);
 void        vfs_file_free (vfs_file_t *file);
 
 fd_table_t *fd_table_create (void);
-fd_table_t *fd_table_clone  (const fd_table_t *src);
+fd_table_t *fd_table_clone  (fd_table_t *src);
 void        fd_table_cloexec(fd_table_t *table);
 void        fd_table_destroy(fd_table_t *table);
+fd_table_t *fd_table_get    (fd_table_t *table);
 
 int         fd_alloc    (fd_table_t *table, vfs_file_t *file, int min_fd);
-vfs_file_t *fd_get      (const fd_table_t *table, int fd);
+vfs_file_t *fd_get      (fd_table_t *table, int fd);
 int         fd_close    (fd_table_t *table, int fd);
 int         fd_dup2     (fd_table_t *table, int oldfd, int newfd);
 int         fd_set_flags(fd_table_t *table, int fd, int flags);
@@ -5,6 +5,7 @@
 #include <stddef.h>
 #include <stdbool.h>
 #include <limine.h>
+#include "../sched/spinlock.h"
 
 #define PAGE_SIZE          4096UL
 #define PAGE_SHIFT         12
@@ -16,6 +17,10 @@
 #define SLAB_MIN_SIZE      8
 #define SLAB_MAX_SIZE      4096
 #define SLAB_NUM_CACHES    10
+#define SLAB_MAX_CACHES    32
+#define SLAB_MAX_ORDER     1
+#define SLAB_MAG_ROUNDS    62
+#define SLAB_DEPOT_MAX     8
 
 #define PMM_FREE_MIN_PHYS 0x100000ULL
 
@@ -25,11 +30,34 @@ typedef struct pmm_block {
     int               order;
 } pmm_block_t;
 
+#define PG_FREE            (1u << 0)
+#define PG_RESERVED        (1u << 1)
+#define PG_PCP             (1u << 2)
+#define PG_ZERO            (1u << 3)
+#define PG_SLAB            (1u << 4)
+
+#define PMM_PCP_HIGH       64
+#define PMM_PCP_BATCH      16
+
+#define PMM_ZERO_POOL_TARGET 256
+
+typedef struct page {
+    uint8_t flags;
+    uint8_t order;
+} page_t;
+
 typedef struct {
     pmm_block_t  head;
     size_t       count;
 } pmm_free_list_t;
 
+typedef struct {
+    spinlock_t lock;
+    uint32_t   count;
+    uint32_t   _pad;
+    uintptr_t  pages[PMM_PCP_HIGH];
+} pmm_pcp_t;
+
 typedef struct {
     uintptr_t       hhdm_offset;
     uintptr_t       mem_start;
@@ -37,27 +65,61 @@ typedef struct {
     size_t          total_pages;
     size_t          usable_pages;
     size_t          free_pages;
+    page_t         *pages;
     pmm_free_list_t orders[PMM_MAX_ORDER_NR];
 } pmm_buddy_state_t;
 
 typedef struct slab {
-    struct slab *next;
-    struct slab *prev;
-    void        *freelist;
-    uint16_t     obj_size;
-    uint16_t     total;
-    uint16_t     used;
-    uint16_t     _pad;
+    struct slab       *next;
+    struct slab       *prev;
+    void              *freelist;
+    struct slab_cache *cache;
+    uint16_t           obj_size;
+    uint16_t           total;
+    uint16_t           used;
+    uint16_t           color;
 } slab_t;
 
+typedef struct slab_magazine {
+    struct slab_magazine *next;
+    uint32_t              rounds;
+    uint32_t              _pad;
+    void                 *objs[SLAB_MAG_ROUNDS];
+} slab_magazine_t;
+
 typedef struct {
-    size_t   obj_size;
-    slab_t  *partial;
-    slab_t  *full;
-    size_t   total_allocs;
-    size_t   total_frees;
+    slab_magazine_t *loaded;
+    slab_magazine_t *prev;
+    size_t           allocs;
+    size_t           frees;
+} slab_cpu_t;
+
+typedef struct slab_cache {
+    const char        *name;
+    size_t             obj_size;
+    size_t             align;
+    size_t             link_off;
+    void             (*ctor)(void *obj);
+    int                id;
+    uint16_t           order;
+    uint16_t           capacity;
+    uint16_t           color_max;
+    uint16_t           color_next;
+    spinlock_t         lock;
+    slab_t            *partial;
+    slab_t            *full;
+    size_t             total_allocs;
+    size_t             total_frees;
+    spinlock_t         depot_lock;
+    slab_magazine_t   *depot_full;
+    slab_magazine_t   *depot_empty;
+    size_t             depot_nfull;
+    size_t             depot_nempty;
+    struct slab_cache *next_cache;
 } slab_cache_t;
 
+typedef slab_cache_t kmem_cache_t;
+
 void  pmm_init(struct limine_memmap_response *memmap,
                struct limine_hhdm_response   *hhdm);
 
@@ -66,6 +128,7 @@ void *pmm_alloc_zero(size_t pages);
 void *pmm_alloc_aligned(size_t pages, size_t alignment);
 void  pmm_free(void *addr, size_t pages);
 void  pmm_free_single(void *addr);
+void  pmm_zero_idle(void);
 
 void     *pmm_phys_to_virt(uintptr_t phys);
 uintptr_t pmm_virt_to_phys(void *vaddr);
@@ -84,6 +147,21 @@ void *krealloc(void *ptr, size_t new_size);
 void  kfree(void *ptr);
 void  slab_print_stats(void);
 
+/* Object caches follow the constructed-state contract: ctor, if given,
+ * runs once per object when its slab is created, not on every alloc.
+ * kmem_cache_alloc() hands out a constructed object and the caller must
+ * return it to kmem_cache_free() in that same constructed state (locks
+ * released, lists emptied, fields the ctor set back to those values).
+ * The free-list link of a ctor cache lives past the end of the object,
+ * so no byte of a constructed object is ever overwritten by the slab.
+ * kmem_cache_zalloc() would destroy that state and returns NULL for
+ * caches that have a ctor. */
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align,
+                                void (*ctor)(void *obj));
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void *kmem_cache_zalloc(kmem_cache_t *cache);
+void  kmem_cache_free(kmem_cache_t *cache, void *obj);
+
 extern slab_cache_t g_caches[SLAB_NUM_CACHES];
 
 #endif
\ No newline at end of file
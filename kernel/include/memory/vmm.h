@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include "../sched/spinlock.h"
+#include "../smp/smp.h"
 
 #define VMM_PRESENT    (1ULL << 0)
 #define VMM_WRITE      (1ULL << 1)
@@ -18,8 +20,16 @@
 
 typedef uint64_t vmm_pte_t;
 
+#define VMM_USER_BRK_MAX 0x0000700000000000ULL
+
 typedef struct {
-    vmm_pte_t* pml4;
+    vmm_pte_t*        pml4;
+    volatile uint32_t refcount;
+    spinlock_t        lock;
+    uintptr_t         brk_start;
+    uintptr_t         brk_current;
+    uintptr_t         brk_max;
+    volatile uint64_t cpu_mask[MAX_CPUS / 64];
 } vmm_pagemap_t;
 
 extern uintptr_t kernel_pml4_phys;
@@ -27,6 +37,7 @@ extern uintptr_t kernel_pml4_phys;
 void vmm_init(void);
 vmm_pagemap_t* vmm_create_pagemap(void);
 void vmm_switch_pagemap(vmm_pagemap_t* map);
+void vmm_pagemap_activate(vmm_pagemap_t* map);
 bool vmm_map_page(vmm_pagemap_t* map, uintptr_t virt, uintptr_t phys, uint64_t flags);
 void vmm_unmap_page(vmm_pagemap_t* map, uintptr_t virt);
 void vmm_unmap_page_noflush(vmm_pagemap_t* map, uintptr_t virt);
@@ -35,6 +46,8 @@ bool vmm_get_page_flags(vmm_pagemap_t* map, uintptr_t virt, uint64_t* flags_out)
 vmm_pagemap_t* vmm_get_kernel_pagemap(void);
 vmm_pagemap_t* vmm_clone_pagemap(vmm_pagemap_t* src);
 void vmm_free_pagemap(vmm_pagemap_t* map);
+void vmm_pagemap_get(vmm_pagemap_t* map);
+void vmm_pagemap_put(vmm_pagemap_t* map);
 void vmm_sync_kernel_mappings(vmm_pagemap_t* map);
 void vmm_test(void);
 
@@ -0,0 +1,12 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <stdint.h>
+
+#define FUTEX_HASH_BITS 8
+#define FUTEX_HASH_SIZE (1U << FUTEX_HASH_BITS)
+
+int64_t futex_wait(uintptr_t uaddr, uint32_t expected, uint64_t timeout_ns);
+int64_t futex_wake(uintptr_t uaddr, uint32_t nr);
+
+#endif
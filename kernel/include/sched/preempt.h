@@ -0,0 +1,43 @@
+#ifndef PREEMPT_H
+#define PREEMPT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PERCPU_PREEMPT_COUNT_OFFSET 20
+#define PERCPU_NEED_RESCHED_OFFSET  40
+
+extern volatile bool g_percpu_ready;
+
+void preempt_schedule(void);
+void preempt_schedule_irq(void);
+
+static inline uint32_t preempt_count(void) {
+    if (!g_percpu_ready) return 0;
+    uint32_t c;
+    asm volatile("movl %%gs:%c1, %0" : "=r"(c) : "i"(PERCPU_PREEMPT_COUNT_OFFSET));
+    return c;
+}
+
+static inline void preempt_disable(void) {
+    if (g_percpu_ready)
+        asm volatile("incl %%gs:%c0" :: "i"(PERCPU_PREEMPT_COUNT_OFFSET) : "memory", "cc");
+}
+
+static inline void preempt_enable_no_resched(void) {
+    if (g_percpu_ready)
+        asm volatile("decl %%gs:%c0" :: "i"(PERCPU_PREEMPT_COUNT_OFFSET) : "memory", "cc");
+}
+
+static inline void preempt_enable(void) {
+    if (!g_percpu_ready) return;
+    bool zero;
+    asm volatile("decl %%gs:%c1" : "=@ccz"(zero) : "i"(PERCPU_PREEMPT_COUNT_OFFSET) : "memory");
+    if (zero) {
+        uint8_t need;
+        asm volatile("movb %%gs:%c1, %0" : "=q"(need) : "i"(PERCPU_NEED_RESCHED_OFFSET));
+        if (need) preempt_schedule();
+    }
+}
+
+#endif
@@ -5,6 +5,8 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include "capabilities.h"
+#include "spinlock.h"
+#include "wait.h"
 #include "../memory/vmm.h"
 #include "../smp/smp.h"
 
@@ -35,7 +37,7 @@ static inline bool atomic_cas_bool(atomic_bool *a, bool *expected, bool desired)
 typedef struct fd_table fd_table_t;
 
 typedef struct {
-    uint8_t data[512] __attribute__((aligned(16)));
+    uint8_t data[4096] __attribute__((aligned(64)));
 } fpu_state_t;
 
 typedef enum {
@@ -55,6 +57,17 @@ typedef enum {
 #define DEFAULT_PRIORITY       16
 #define TASK_DEFAULT_TIMESLICE 10
 
+#define SCHED_CLASS_FAIR       0
+#define SCHED_CLASS_FIFO       1
+#define SCHED_CLASS_RR         2
+
+#define SCHED_RT_MAX_PER_CPU   8
+#define KSTACK_POOL_PER_CPU    8
+#define SCHED_RECLAIM_BATCH    16
+
+#define SCHED_FAIR_GRAN_NS     4000000ULL
+#define SCHED_FAIR_LATENCY_NS  20000000ULL
+
 typedef struct task {
     uint64_t rsp;
     uint64_t rip;
@@ -103,9 +116,8 @@ typedef struct task {
     volatile bool pending_kill;
     uint8_t _pad4[3];
 
-    uintptr_t brk_start;
-    uintptr_t brk_current;
-    uintptr_t brk_max;
+    uint64_t fs_base;
+    uint8_t _pad8[16];
     vmm_pagemap_t* pagemap;
 
     uint32_t flags;
@@ -125,15 +137,67 @@ typedef struct task {
     fd_table_t      *fd_table;
 
     atomic_bool on_cpu;
+    atomic_bool on_rq;
+    uint8_t _pad5[6];
+
+    struct task*     prev;
+    struct runqueue* rq;
+
+    uint32_t sleep_slot;
+    uint8_t _pad6[4];
+
+    wait_queue_t child_wq;
+
+    uint8_t  sched_class;
+    int8_t   rq_level;
+    uint16_t rt_cpu;
+    uint8_t _pad7[4];
+    uint64_t vruntime;
+    uint64_t exec_start;
+    uint64_t wake_stamp;
+    struct task* rcu_next;
+    uint64_t rcu_seq;
+    struct task* reclaim_next;
+    uint64_t nvcsw;
+    uint64_t nivcsw;
+    uint64_t wait_time_ns;
+    uint64_t queued_tsc;
+    uint32_t nr_migrations;
+    uint32_t preempt_count;
 
 } task_t;
 
+static inline bool sched_class_is_rt(uint8_t c) {
+    return c == SCHED_CLASS_FIFO || c == SCHED_CLASS_RR;
+}
+
+typedef struct {
+    task_t* head;
+    task_t* tail;
+} rq_list_t;
+
+typedef struct runqueue {
+    spinlock_t lock;
+    uint32_t   nr_running;
+    uint32_t   bitmap;
+    rq_list_t  queues[MAX_PRIORITY + 1];
+    rq_list_t  fair;
+    uint32_t   nr_fair;
+    uint64_t   min_vruntime;
+    uint32_t   nr_rt_admitted;
+} runqueue_t;
+
+_Static_assert(MAX_PRIORITY < 32, "runqueue_t: bitmap holds one bit per priority");
+
 #define TASK_FLAG_TRACE          (1 << 0)
 #define TASK_FLAG_VFORK          (1 << 1)
 #define TASK_FLAG_FORK           (1 << 2)
 #define TASK_FLAG_STARTED        (1 << 3)
 #define TASK_FLAG_OWN_PAGEMAP    (1 << 4)
 #define TASK_FLAG_STACK_DEFERRED (1 << 5)
+#define TASK_FLAG_THREAD         (1 << 6)
+#define TASK_FLAG_TORNDOWN       (1U << 29)
+#define TASK_FLAG_REAPED         (1U << 30)
 #define TASK_FLAG_DESTROYED      (1U << 31)
 
 _Static_assert(offsetof(task_t, rsp)            ==   0, "task_t: rsp");
@@ -144,9 +208,19 @@ _Static_assert(offsetof(task_t, user_rsp)       == 144, "task_t: user_rsp — up
 _Static_assert(offsetof(task_t, user_saved_rip) == 272, "task_t: user_saved_rip");
 _Static_assert(offsetof(task_t, user_saved_rbp) == 280, "task_t: user_saved_rbp — update TASK_USER_SAVED_RBP_OFFSET");
 
-extern task_t* ready_queues[MAX_PRIORITY + 1];
 extern task_t* current_task[MAX_CPUS];
 
+/* task_find_by_pid() results stay valid only until rcu_read_unlock(). */
+static inline uint64_t rcu_read_lock(void) {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void rcu_read_unlock(uint64_t flags) {
+    asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
+}
+
 void sched_init(void);
 void sched_reschedule(void);
 void sched_print_stats(void);
@@ -160,15 +234,33 @@ __attribute__((noreturn)) void task_exit(void);
 void    task_kill(task_t* task);
 void    task_destroy(task_t* task);
 task_t* task_fork(task_t* parent);
+task_t* task_clone(task_t* parent, uint64_t flags, uintptr_t user_stack, uint64_t tls);
+task_t* task_spawn(task_t* parent, const char* name, uintptr_t entry, uintptr_t user_rsp,
+                   vmm_pagemap_t* pagemap, fd_table_t* fd_table);
+void    task_vfork_wait(task_t* parent, task_t* child);
+void    task_vfork_done(task_t* child);
+void    task_set_fs_base(task_t* t, uint64_t base);
 task_t* task_find_by_pid(uint32_t pid);
 uint32_t task_alloc_pid(void);
 void    task_reparent(task_t* child, task_t* new_parent);
 
-#include "spinlock.h"
 extern spinlock_t children_lock;
-void    task_wakeup_waiters(uint32_t pid);
+void    task_wakeup_waiters(task_t* child);
+void    task_block(task_t* t);
 void    task_unblock(task_t* t);
+uint64_t sched_online_mask(void);
+int     sched_set_affinity(task_t* t, uint64_t mask);
+int     sched_set_class(task_t* t, int sched_class, int priority);
+bool    sched_tick(task_t* cur);
+void    sched_quiescent(void);
+void    sched_reclaim(void);
+void    sched_sleep_until(task_t* t, uint64_t deadline_ns);
+void    sched_sleep_cancel(task_t* t);
 void    sched_wakeup_sleepers(uint64_t now_ns);
+int     sched_nohz_enter(uint32_t cpu);
+void    sched_nohz_exit(uint32_t cpu);
+void    sched_nohz_kick(uint32_t cpu);
+void    sched_irq_enter(void);
 task_t* task_find_foreground(void);
 extern volatile uint32_t g_foreground_pid;
 void task_set_foreground(uint32_t pid);
@@ -0,0 +1,25 @@
+#ifndef SCHED_TRACE_H
+#define SCHED_TRACE_H
+
+#include <stdint.h>
+#include "../syscall/syscall_nums.h"
+
+#define SCHED_TRACE_ENTRIES 512
+#define SCHED_LAT_BUCKETS   16
+
+_Static_assert((SCHED_TRACE_ENTRIES & (SCHED_TRACE_ENTRIES - 1)) == 0,
+               "SCHED_TRACE_ENTRIES must be a power of two");
+
+static inline uint64_t sched_rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+void     sched_trace_init(void);
+void     sched_trace_event(uint16_t type, uint32_t pid, uint32_t arg, uint32_t arg2);
+void     sched_trace_latency(uint64_t ns);
+uint64_t sched_trace_tsc_to_ns(uint64_t cycles);
+void     sched_trace_print(void);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef WAIT_H
+#define WAIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "spinlock.h"
+
+struct task;
+
+typedef struct wait_entry {
+    struct task*       task;
+    struct wait_entry* prev;
+    struct wait_entry* next;
+    uint64_t           key;
+    volatile bool      queued;
+} wait_entry_t;
+
+typedef struct {
+    spinlock_t    lock;
+    wait_entry_t* head;
+    wait_entry_t* tail;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT { .lock = SPINLOCK_INIT, .head = NULL, .tail = NULL }
+
+void wait_queue_init(wait_queue_t* wq);
+void wait_prepare(wait_queue_t* wq, wait_entry_t* e);
+void wait_sleep(wait_entry_t* e);
+int  wait_sleep_until(wait_entry_t* e, uint64_t deadline_ns);
+bool wait_finish(wait_queue_t* wq, wait_entry_t* e);
+int  wait_wake_one(wait_queue_t* wq);
+int  wait_wake_all(wait_queue_t* wq);
+int  wait_wake_key(wait_queue_t* wq, uint64_t key, int nr);
+
+#endif
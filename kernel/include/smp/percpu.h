@@ -3,14 +3,16 @@
 
 #include <stdint.h>
 #include "../include/smp/smp.h"
+#include "../include/sched/sched.h"
+#include "../include/memory/pmm.h"
 
 #define PERCPU_SECTION __attribute__((section(".percpu")))
 
-typedef struct {
+typedef struct percpu {
     uint64_t syscall_kernel_rsp;
     uint64_t syscall_user_rsp;
     uint32_t cpu_id;
-    uint32_t _pad;
+    uint32_t preempt_count;
     void* current_task;
     uint64_t some_counter;
     bool need_resched;
@@ -27,12 +29,26 @@ typedef struct {
     uint8_t  _pad3[8];
     void* deferred_free_task;
     uint64_t sched_stack_top;
+    runqueue_t rq;
+    bool       tick_stopped;
+    uint32_t   kstack_pool_count;
+    uintptr_t  kstack_pool[KSTACK_POOL_PER_CPU];
+    uint64_t   rcu_qs;
+    task_t*    reclaim_head;
+    uint32_t   reclaim_count;
+    struct percpu* self;
+    pmm_pcp_t  pcp;
+    slab_cpu_t slab[SLAB_MAX_CACHES];
+    vmm_pagemap_t* active_pagemap;
+    bool       rcu_nohz;
 } __attribute__((aligned(64))) percpu_t;
 
 _Static_assert(__builtin_offsetof(percpu_t, syscall_kernel_rsp) == 0, "percpu: kernel_rsp");
 _Static_assert(__builtin_offsetof(percpu_t, syscall_user_rsp) == 8, "percpu: user_rsp");
+_Static_assert(__builtin_offsetof(percpu_t, cpu_id) == 16, "percpu: cpu_id");
+_Static_assert(__builtin_offsetof(percpu_t, preempt_count) == PERCPU_PREEMPT_COUNT_OFFSET, "percpu: preempt_count");
 _Static_assert(__builtin_offsetof(percpu_t, current_task) == 24, "percpu: current_task");
-_Static_assert(__builtin_offsetof(percpu_t, need_resched) == 40, "percpu: need_resched");
+_Static_assert(__builtin_offsetof(percpu_t, need_resched) == PERCPU_NEED_RESCHED_OFFSET, "percpu: need_resched");
 _Static_assert(__builtin_offsetof(percpu_t, user_saved_rbp) == 48, "percpu: saved_rbp");
 _Static_assert(__builtin_offsetof(percpu_t, user_saved_rbx) == 56, "percpu: saved_rbx");
 _Static_assert(__builtin_offsetof(percpu_t, user_saved_r12) == 64, "percpu: saved_r12");
@@ -45,11 +61,32 @@ _Static_assert(__builtin_offsetof(percpu_t, user_saved_rip) == 104, "percpu: sav
 extern percpu_t percpu;
 extern percpu_t* percpu_regions[MAX_CPUS];
 extern bool g_has_fsgsbase;
+extern volatile bool g_percpu_ready;
 
 percpu_t* get_percpu(void);
 percpu_t* get_percpu_mut(void);
 void init_percpu_regions(void);
 void set_percpu_base(percpu_t* base);
-#define current_cpu_id() (get_percpu()->cpu_id)
+
+/* GS-relative accessors; only valid once this CPU has called set_percpu_base(). */
+static inline percpu_t* this_cpu(void) {
+    percpu_t* pc;
+    asm volatile("mov %%gs:%c1, %0" : "=r"(pc) : "i"(__builtin_offsetof(percpu_t, self)));
+    return pc;
+}
+
+static inline uint32_t this_cpu_id(void) {
+    uint32_t id;
+    asm volatile("movl %%gs:%c1, %0" : "=r"(id) : "i"(__builtin_offsetof(percpu_t, cpu_id)));
+    return id;
+}
+
+static inline task_t* this_task(void) {
+    task_t* t;
+    asm volatile("mov %%gs:%c1, %0" : "=r"(t) : "i"(__builtin_offsetof(percpu_t, current_task)));
+    return t;
+}
+
+#define current_cpu_id() this_cpu_id()
 
 #endif
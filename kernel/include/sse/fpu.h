@@ -14,4 +14,19 @@ void fpu_set_tag_word(uint16_t tw);
 uint16_t fpu_get_tag_word(void);
 void fpu_reset(void);
 
+#define FPU_SAVE_FXSAVE   0
+#define FPU_SAVE_XSAVE    1
+#define FPU_SAVE_XSAVEOPT 2
+
+#define XFEATURE_X87 (1ULL << 0)
+#define XFEATURE_SSE (1ULL << 1)
+#define XFEATURE_AVX (1ULL << 2)
+
+extern uint32_t fpu_save_mode;
+extern uint32_t fpu_state_size;
+extern uint64_t fpu_xcr0;
+
+void fpu_xsave_init(void);
+void fpu_state_init(void* area);
+
 #endif
\ No newline at end of file
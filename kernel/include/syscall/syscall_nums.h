@@ -8,6 +8,9 @@
 #define SYS_FORK          4
 #define SYS_WAIT          5
 #define SYS_EXECVE        14
+#define SYS_CLONE         15
+#define SYS_SET_TLS       16
+#define SYS_VFORK         17
 #define SYS_YIELD         6
 #define SYS_GETUID        7
 #define SYS_GETGID        8
@@ -79,7 +82,12 @@
 #define SYS_LIST_MOUNTS       546
 #define SYS_STATVFS           547
 
-#define SYSCALL_TABLE_SIZE    548
+#define SYS_SCHED_SETAFFINITY 548
+#define SYS_SCHED_GETAFFINITY 549
+#define SYS_SCHED_SETSCHEDULER 550
+#define SYS_SCHED_GETSCHEDULER 551
+
+#define SYSCALL_TABLE_SIZE    552
 
 #define PROT_NONE    0x0
 #define PROT_READ    0x1
@@ -93,6 +101,20 @@
 
 #define WNOHANG    0x1
 
+#define CLONE_VM       0x00000100
+#define CLONE_FILES    0x00000400
+#define CLONE_VFORK    0x00004000
+#define CLONE_THREAD   0x00010000
+#define CLONE_SETTLS   0x00080000
+
+#define SPAWN_ACTION_DUP2   1
+#define SPAWN_ACTION_CLOSE  2
+#define SPAWN_MAX_ACTIONS   16
+
+#define SCHED_OTHER  0
+#define SCHED_FIFO   1
+#define SCHED_RR     2
+
 #define CLOCK_REALTIME   0
 #define CLOCK_MONOTONIC  1
 
@@ -106,8 +128,33 @@ typedef struct {
     uint32_t state;
     uint32_t priority;
     uint64_t total_runtime_ns;
+    uint64_t nvcsw;
+    uint64_t nivcsw;
+    uint64_t wait_time_ns;
+    uint32_t nr_migrations;
+    uint32_t last_cpu;
 } cervus_task_info_t;
 
+#define SCHED_EV_SWITCH   1
+#define SCHED_EV_WAKEUP   2
+#define SCHED_EV_MIGRATE  3
+
+typedef struct {
+    uint64_t tsc;
+    uint32_t pid;
+    uint32_t arg;
+    uint16_t type;
+    uint16_t cpu;
+    uint32_t arg2;
+} cervus_sched_event_t;
+
+typedef struct {
+    int32_t  op;
+    int32_t  fd;
+    int32_t  newfd;
+    int32_t  _pad;
+} cervus_spawn_action_t;
+
 typedef struct {
     int64_t  tv_sec;
     int64_t  tv_nsec;
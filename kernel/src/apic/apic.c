@@ -11,6 +11,7 @@ uintptr_t lapic_base = 0;
 uintptr_t ioapic_base = 0;
 uintptr_t hpet_base = 0;
 uint32_t hpet_period = 0;
+uint32_t apic_timer_period = 0;
 static acpi_madt_t* madt = NULL;
 static acpi_hpet_t* hpet_table = NULL;
 
@@ -208,5 +209,21 @@ void apic_timer_calibrate(void) {
 
     if (ticks_per_10ms == 0) return;
 
+    apic_timer_period = ticks_per_10ms;
     lapic_timer_init(0x20, ticks_per_10ms, true, 0x3);
+}
+
+void apic_timer_periodic(void) {
+    if (!apic_timer_period) return;
+    lapic_write(LAPIC_TIMER, 0x20 | LAPIC_TIMER_PERIODIC);
+    lapic_write(LAPIC_TIMER_ICR, apic_timer_period);
+}
+
+void apic_timer_oneshot_ns(uint64_t ns) {
+    if (!apic_timer_period) return;
+    uint64_t count = (ns / 1000ULL) * apic_timer_period / 10000ULL;
+    if (count == 0) count = 1;
+    if (count > 0xFFFFFFFFULL) count = 0xFFFFFFFFULL;
+    lapic_write(LAPIC_TIMER, 0x20);
+    lapic_write(LAPIC_TIMER_ICR, (uint32_t)count);
 }
\ No newline at end of file
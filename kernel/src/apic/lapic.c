@@ -4,6 +4,7 @@
 #include "../../include/memory/pmm.h"
 #include "../../include/smp/smp.h"
 #include "../../include/interrupts/interrupts.h"
+#include "../../include/sched/preempt.h"
 #include <stddef.h>
 
 static inline uintptr_t phys_to_virt(uintptr_t phys) {
@@ -135,7 +136,7 @@ void ipi_reschedule_all(void) {
 }
 
 void ipi_reschedule_cpu(uint32_t lapic_id) {
-    lapic_send_ipi(lapic_id, IPI_RESCHEDULE_VECTOR);
+    ipi_reschedule_single(lapic_id);
 }
 
 void ipi_reschedule_single(uint32_t target_lapic_id) {
@@ -147,8 +148,6 @@ void ipi_reschedule_single(uint32_t target_lapic_id) {
 
     while (lapic_read(0x300) & (1 << 12))
         asm volatile ("pause");
-
-    serial_printf("Reschedule IPI sent to LAPIC %u\n", target_lapic_id);
 }
 
 void ipi_tlb_shootdown_broadcast(const uintptr_t* addrs, size_t count) {
@@ -204,4 +203,58 @@ void ipi_tlb_shootdown_single(uint32_t target_lapic_id, uintptr_t addr) {
 
     serial_printf("TLB shootdown sent to LAPIC %u for virt 0x%llx\n",
                   target_lapic_id, addr);
-}
\ No newline at end of file
+}
+
+static volatile uint32_t tlb_sender_lock = 0;
+
+void tlb_shootdown_service(uint32_t lapic_id) {
+    tlb_shootdown_t* q = &tlb_shootdown_queue[lapic_id];
+    if (!__atomic_load_n(&q->pending, __ATOMIC_ACQUIRE)) return;
+    for (size_t i = 0; i < q->count; i++) {
+        uintptr_t addr = q->addresses[i];
+        if (addr != 0)
+            asm volatile ("invlpg (%0)" :: "r"(addr) : "memory");
+    }
+    q->count = 0;
+    __atomic_store_n(&q->pending, false, __ATOMIC_RELEASE);
+}
+
+void ipi_tlb_shootdown_mask(const volatile uint64_t* mask, size_t words, uintptr_t addr) {
+    /* Pin to this CPU for the whole send: a preempting task that also
+     * unmaps would otherwise spin on a lock its own CPU holds, and a
+     * migration would make my_lapic stale. */
+    preempt_disable();
+    uint32_t my_lapic = lapic_get_id();
+
+    while (__atomic_exchange_n(&tlb_sender_lock, 1, __ATOMIC_ACQUIRE)) {
+        tlb_shootdown_service(my_lapic);
+        asm volatile ("pause");
+    }
+
+    for (size_t w = 0; w < words; w++) {
+        uint64_t bits = __atomic_load_n(&mask[w], __ATOMIC_ACQUIRE);
+        while (bits) {
+            uint32_t target = (uint32_t)(w * 64 + __builtin_ctzll(bits));
+            bits &= bits - 1;
+            if (target == my_lapic || target >= MAX_CPUS) continue;
+
+            tlb_shootdown_t* q = &tlb_shootdown_queue[target];
+            q->addresses[0] = addr;
+            q->count = 1;
+            __atomic_store_n(&q->pending, true, __ATOMIC_RELEASE);
+
+            lapic_write(0x310, target << 24);
+            lapic_write(0x300, IPI_TLB_SHOOTDOWN | (0 << 8) | (1 << 14));
+            while (lapic_read(0x300) & (1 << 12))
+                asm volatile ("pause");
+
+            while (__atomic_load_n(&q->pending, __ATOMIC_ACQUIRE)) {
+                tlb_shootdown_service(my_lapic);
+                asm volatile ("pause");
+            }
+        }
+    }
+
+    __atomic_store_n(&tlb_sender_lock, 0, __ATOMIC_RELEASE);
+    preempt_enable();
+}
@@ -29,6 +29,7 @@ static volatile bool    mouse_has_scroll = false;
 static volatile uint32_t mouse_lost_sync = 0;
 
 static volatile kb_buf_t kb_buf;
+wait_queue_t kb_wait_queue = WAIT_QUEUE_INIT;
 
 static const char sc_lower[89] = {
     0,    '\x1b','1',  '2',  '3',  '4',  '5',  '6',
@@ -180,6 +181,7 @@ void kb_buf_push(char c) {
         kb_buf.buf[kb_buf.tail] = c;
         kb_buf.tail = next;
     }
+    wait_wake_all(&kb_wait_queue);
 }
 
 extern uint32_t cursor_x;
@@ -258,6 +260,7 @@ DEFINE_IRQ(KB_IRQ_VECTOR, ps2_kb_handler)
             serial_printf("[PS2] ctrl char generated: 0x%02x\n", ctrl_char);
             if (ctrl_char == 0x03) {
                 g_ctrlc_pending = 1;
+                sched_nohz_kick(0);
                 lapic_eoi();
                 return;
             }
@@ -20,9 +20,9 @@ DEFINE_IRQ(0x20, timer_handler)
     ticks++;
     lapic_eoi();
 
-    uint32_t cpu = lapic_get_id();
-    task_t* current = current_task[cpu];
-    percpu_t* pc = get_percpu();
+    percpu_t* pc = this_cpu();
+    uint32_t cpu = pc->cpu_id;
+    task_t* current = (task_t*)pc->current_task;
 
     if (cpu == 0 && g_ctrlc_pending) {
         g_ctrlc_pending = 0;
@@ -41,19 +41,18 @@ DEFINE_IRQ(0x20, timer_handler)
         sched_wakeup_sleepers(hpet_elapsed_ns());
     }
 
+    sched_quiescent();
+
     if (!current) return;
 
-    if (current->pending_kill && pc) {
+    if (current->pending_kill) {
         current->time_slice = 0;
         pc->need_resched = true;
         (void)frame;
         return;
     }
 
-    if (current->time_slice > 0)
-        current->time_slice--;
-
-    if (current->time_slice == 0 && pc)
+    if (sched_tick(current))
         pc->need_resched = true;
 
     (void)frame;
@@ -79,9 +79,8 @@ static int64_t tty_read(vnode_t *node, void *buf, size_t len, uint64_t offset) {
 
     char *dst = buf;
 
-    uint64_t freq      = hpet_is_available() ? hpet_get_frequency() : 0;
-    uint64_t half_tick = freq ? freq / 2 : 0;
-    uint64_t next_blink = half_tick ? (hpet_read_counter() + half_tick) : 0;
+    uint64_t blink_ns   = hpet_is_available() ? 500000000ULL : 0;
+    uint64_t next_blink = blink_ns ? (hpet_elapsed_ns() + blink_ns) : 0;
     int      cursor_on  = 1;
     int      canonical  = tty_is_canonical();
     int      isig       = tty_has_isig();
@@ -97,15 +96,21 @@ static int64_t tty_read(vnode_t *node, void *buf, size_t len, uint64_t offset) {
             return -EINTR;
         }
 
-        if (half_tick) {
-            uint64_t now = hpet_read_counter();
+        if (blink_ns) {
+            uint64_t now = hpet_elapsed_ns();
             if (now >= next_blink) {
                 if (cursor_on) { erase_cursor(); cursor_on = 0; }
                 else           { draw_cursor();  cursor_on = 1; }
-                next_blink = now + half_tick;
+                next_blink = now + blink_ns;
             }
         }
-        task_yield();
+
+        if (!me) { task_yield(); continue; }
+        wait_entry_t wait = {0};
+        wait_prepare(&kb_wait_queue, &wait);
+        if (kb_buf_empty() && !me->pending_kill)
+            wait_sleep_until(&wait, next_blink);
+        wait_finish(&kb_wait_queue, &wait);
     }
 
     erase_cursor();
@@ -233,12 +233,13 @@ static int set_block_num(ext2_t *fs, ext2_inode_t *di, uint32_t file_block, uint
 
 static const vnode_ops_t ext2_file_ops;
 static const vnode_ops_t ext2_dir_ops;
+static kmem_cache_t     *g_ext2_vdata_cache;
 
 static vnode_t *ext2_make_vnode(ext2_t *fs, uint32_t ino, ext2_inode_t *di) {
-    vnode_t *v = kzalloc(sizeof(vnode_t));
+    vnode_t *v = vnode_alloc();
     if (!v) return NULL;
-    ext2_vdata_t *vd = kzalloc(sizeof(ext2_vdata_t));
-    if (!vd) { kfree(v); return NULL; }
+    ext2_vdata_t *vd = kmem_cache_zalloc(g_ext2_vdata_cache);
+    if (!vd) { vnode_free(v); return NULL; }
     vd->fs  = fs;
     vd->ino = ino;
     if ((di->i_mode & 0xF000) == EXT2_S_IFDIR) {
@@ -401,8 +402,8 @@ static int ext2_stat(vnode_t *node, vfs_stat_t *out) {
 
 static void ext2_vnode_ref(vnode_t *node)  { (void)node; }
 static void ext2_vnode_unref(vnode_t *node) {
-    if (node->fs_data) kfree(node->fs_data);
-    kfree(node);
+    if (node->fs_data) kmem_cache_free(g_ext2_vdata_cache, node->fs_data);
+    vnode_free(node);
 }
 
 static const vnode_ops_t ext2_file_ops = {
@@ -870,6 +871,8 @@ int ext2_format(blkdev_t *dev, const char *label) {
 
 vnode_t *ext2_mount(blkdev_t *dev) {
     if (!dev) return NULL;
+    if (!g_ext2_vdata_cache)
+        g_ext2_vdata_cache = kmem_cache_create("ext2_vdata", sizeof(ext2_vdata_t), 8, NULL);
     ext2_t *fs = kzalloc(sizeof(ext2_t));
     if (!fs) return NULL;
     fs->dev = dev;
@@ -474,7 +474,7 @@ static void fat32_common_unref(vnode_t *n) {
             free(vd);
             n->fs_data = NULL;
         }
-        free(n);
+        vnode_free(n);
     }
 }
 
@@ -895,10 +895,10 @@ static vnode_t *fat32_alloc_vnode(fat32_t *fs, uint32_t first_cluster,
                                   uint32_t size, uint8_t attr,
                                   uint32_t dir_cluster, uint32_t dir_entry_off)
 {
-    vnode_t *vn = calloc(1, sizeof(vnode_t));
+    vnode_t *vn = vnode_alloc();
     if (!vn) return NULL;
     fat32_vdata_t *vd = calloc(1, sizeof(fat32_vdata_t));
-    if (!vd) { free(vn); return NULL; }
+    if (!vd) { vnode_free(vn); return NULL; }
 
     vd->fs               = fs;
     vd->first_cluster    = first_cluster;
@@ -28,11 +28,11 @@ static const vnode_ops_t ramfs_dir_ops;
 
 
 static vnode_t *ramfs_alloc_vnode(vnode_type_t type, uint32_t mode) {
-    vnode_t *v = kzalloc(sizeof(vnode_t));
+    vnode_t *v = vnode_alloc();
     if (!v) return NULL;
 
     ramfs_node_t *rn = kzalloc(sizeof(ramfs_node_t));
-    if (!rn) { kfree(v); return NULL; }
+    if (!rn) { vnode_free(v); return NULL; }
 
     rn->ino    = g_next_ino++;
     v->type    = type;
@@ -60,7 +60,7 @@ static void ramfs_unref(vnode_t *node) {
     }
 
     kfree(rn);
-    kfree(node);
+    vnode_free(node);
 }
 
 static int64_t ramfs_file_read(vnode_t *node, void *buf,
@@ -212,7 +212,7 @@ static int ramfs_dir_mkdir(vnode_t *dir, const char *name, uint32_t mode) {
     int ret = ramfs_dir_add_child(dir, name, child);
     if (ret < 0) {
         kfree(child->fs_data);
-        kfree(child);
+        vnode_free(child);
         return ret;
     }
 
@@ -236,7 +236,7 @@ static int ramfs_dir_create(vnode_t *dir, const char *name, uint32_t mode, vnode
     int ret = ramfs_dir_add_child(dir, name, child);
     if (ret < 0) {
         kfree(child->fs_data);
-        kfree(child);
+        vnode_free(child);
         return ret;
     }
 
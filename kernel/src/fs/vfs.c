@@ -4,17 +4,27 @@
 #include "../../include/io/serial.h"
 #include <string.h>
 
-static vfs_mount_t  g_mounts[VFS_MAX_MOUNTS];
-static vfs_file_t   g_open_files[VFS_MAX_OPEN_FILES];
-static bool         g_vfs_ready = false;
+static vfs_mount_t   g_mounts[VFS_MAX_MOUNTS];
+static kmem_cache_t *g_vnode_cache;
+static kmem_cache_t *g_file_cache;
+static bool          g_vfs_ready = false;
 
 void vfs_init(void) {
-    memset(g_mounts,     0, sizeof(g_mounts));
-    memset(g_open_files, 0, sizeof(g_open_files));
+    memset(g_mounts, 0, sizeof(g_mounts));
+    g_vnode_cache = kmem_cache_create("vnode", sizeof(vnode_t), 8, NULL);
+    g_file_cache  = kmem_cache_create("vfs_file", sizeof(vfs_file_t), 8, NULL);
     g_vfs_ready = true;
     serial_writestring("[VFS] initialized\n");
 }
 
+vnode_t *vnode_alloc(void) {
+    return kmem_cache_zalloc(g_vnode_cache);
+}
+
+void vnode_free(vnode_t *node) {
+    kmem_cache_free(g_vnode_cache, node);
+}
+
 void vnode_ref(vnode_t *node) {
     if (!node) return;
     __atomic_fetch_add(&node->refcount, 1, __ATOMIC_RELAXED);
@@ -199,14 +209,9 @@ int vfs_lookup(const char *path, vnode_t **out) {
 }
 
 vfs_file_t *vfs_file_alloc(void) {
-    for (int i = 0; i < VFS_MAX_OPEN_FILES; i++) {
-        if (g_open_files[i].refcount == 0) {
-            memset(&g_open_files[i], 0, sizeof(vfs_file_t));
-            g_open_files[i].refcount = 1;
-            return &g_open_files[i];
-        }
-    }
-    return NULL;
+    vfs_file_t *file = kmem_cache_zalloc(g_file_cache);
+    if (file) file->refcount = 1;
+    return file;
 }
 
 void vfs_file_free(vfs_file_t *file) {
@@ -215,6 +220,7 @@ void vfs_file_free(vfs_file_t *file) {
     if (old == 1) {
         vnode_unref(file->vnode);
         file->vnode = NULL;
+        kmem_cache_free(g_file_cache, file);
     }
 }
 
@@ -433,35 +439,49 @@ int vfs_mkdir(const char *path, uint32_t mode) {
 
 fd_table_t *fd_table_create(void) {
     fd_table_t *t = kzalloc(sizeof(fd_table_t));
+    if (t) t->refcount = 1;
     return t;
 }
 
-fd_table_t *fd_table_clone(const fd_table_t *src) {
+fd_table_t *fd_table_get(fd_table_t *table) {
+    if (table) __atomic_fetch_add(&table->refcount, 1, __ATOMIC_RELAXED);
+    return table;
+}
+
+fd_table_t *fd_table_clone(fd_table_t *src) {
     if (!src) return NULL;
     fd_table_t *dst = kzalloc(sizeof(fd_table_t));
     if (!dst) return NULL;
+    dst->refcount = 1;
+    spinlock_acquire(&src->lock);
     for (int i = 0; i < TASK_MAX_FDS; i++) {
         if (src->entries[i].file) {
             dst->entries[i] = src->entries[i];
             __atomic_fetch_add(&dst->entries[i].file->refcount, 1, __ATOMIC_RELAXED);
         }
     }
+    spinlock_release(&src->lock);
     return dst;
 }
 
 void fd_table_cloexec(fd_table_t *table) {
     if (!table) return;
     for (int i = 0; i < TASK_MAX_FDS; i++) {
+        spinlock_acquire(&table->lock);
+        vfs_file_t *file = NULL;
         if (table->entries[i].file && (table->entries[i].fd_flags & FD_CLOEXEC)) {
-            vfs_file_free(table->entries[i].file);
+            file = table->entries[i].file;
             table->entries[i].file     = NULL;
             table->entries[i].fd_flags = 0;
         }
+        spinlock_release(&table->lock);
+        if (file) vfs_file_free(file);
     }
 }
 
 void fd_table_destroy(fd_table_t *table) {
     if (!table) return;
+    if (__atomic_sub_fetch(&table->refcount, 1, __ATOMIC_ACQ_REL) > 0) return;
     for (int i = 0; i < TASK_MAX_FDS; i++) {
         if (table->entries[i].file) {
             vfs_file_free(table->entries[i].file);
@@ -474,28 +494,37 @@ void fd_table_destroy(fd_table_t *table) {
 int fd_alloc(fd_table_t *table, vfs_file_t *file, int min_fd) {
     if (!table || !file) return -EINVAL;
     if (min_fd < 0 || min_fd >= TASK_MAX_FDS) return -EINVAL;
+    spinlock_acquire(&table->lock);
     for (int i = min_fd; i < TASK_MAX_FDS; i++) {
         if (!table->entries[i].file) {
             table->entries[i].file     = file;
             table->entries[i].fd_flags = 0;
+            spinlock_release(&table->lock);
             return i;
         }
     }
+    spinlock_release(&table->lock);
     return -EMFILE;
 }
 
-vfs_file_t *fd_get(const fd_table_t *table, int fd) {
+vfs_file_t *fd_get(fd_table_t *table, int fd) {
     if (!table || fd < 0 || fd >= TASK_MAX_FDS) return NULL;
-    return table->entries[fd].file;
+    spinlock_acquire(&table->lock);
+    vfs_file_t *file = table->entries[fd].file;
+    if (file) __atomic_fetch_add(&file->refcount, 1, __ATOMIC_RELAXED);
+    spinlock_release(&table->lock);
+    return file;
 }
 
 int fd_close(fd_table_t *table, int fd) {
     if (!table || fd < 0 || fd >= TASK_MAX_FDS) return -EBADF;
+    spinlock_acquire(&table->lock);
     vfs_file_t *file = table->entries[fd].file;
-    if (!file) return -EBADF;
-    vfs_file_free(file);
     table->entries[fd].file     = NULL;
     table->entries[fd].fd_flags = 0;
+    spinlock_release(&table->lock);
+    if (!file) return -EBADF;
+    vfs_file_free(file);
     return 0;
 }
 
@@ -505,15 +534,17 @@ int fd_dup2(fd_table_t *table, int oldfd, int newfd) {
     if (newfd < 0 || newfd >= TASK_MAX_FDS) return -EBADF;
     if (oldfd == newfd) return newfd;
 
+    spinlock_acquire(&table->lock);
     vfs_file_t *src = table->entries[oldfd].file;
-    if (!src) return -EBADF;
-
-    if (table->entries[newfd].file)
-        vfs_file_free(table->entries[newfd].file);
+    if (!src) { spinlock_release(&table->lock); return -EBADF; }
 
+    vfs_file_t *old = table->entries[newfd].file;
     table->entries[newfd].file     = src;
     table->entries[newfd].fd_flags = 0;
     __atomic_fetch_add(&src->refcount, 1, __ATOMIC_RELAXED);
+    spinlock_release(&table->lock);
+
+    if (old) vfs_file_free(old);
     return newfd;
 }
 
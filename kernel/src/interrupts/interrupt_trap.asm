@@ -1,9 +1,11 @@
 section .text
 extern base_trap
 extern sched_reschedule
+extern preempt_schedule_irq
 extern get_percpu
 
-PERCPU_NEED_RESCHED equ 40
+PERCPU_PREEMPT_COUNT equ 20
+PERCPU_NEED_RESCHED  equ 40
 
 common_stub:
     push rax
@@ -64,9 +66,11 @@ common_stub:
     jz .kernel_check_cs
     cmp byte [rax + PERCPU_NEED_RESCHED], 0
     je .kernel_check_cs
-    mov byte [rax + PERCPU_NEED_RESCHED], 0
-    call sched_reschedule
-    jmp .kernel_resched
+    cmp dword [rax + PERCPU_PREEMPT_COUNT], 0
+    jne .kernel_check_cs
+    test qword [rsp + 19*8], (1 << 9)
+    jz .kernel_check_cs
+    call preempt_schedule_irq
 
 .kernel_check_cs:
     mov rax, [rsp + 18*8]
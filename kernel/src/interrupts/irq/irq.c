@@ -5,6 +5,7 @@
 #include "../../../include/io/ports.h"
 #include "../../../include/smp/percpu.h"
 #include "../../../include/apic/apic.h"
+#include "../../../include/sched/sched.h"
 
 extern const int_desc_t __start_irq_handlers[];
 extern const int_desc_t __stop_irq_handlers[];
@@ -21,6 +22,8 @@ void irq_common_handler(struct int_frame_t* regs) {
         }
     }
 
+    sched_irq_enter();
+
     if(registered_irq_interrupts[vec]) {
         return registered_irq_interrupts[vec](regs);
     }
@@ -51,10 +54,7 @@ DEFINE_IRQ(IPI_RESCHEDULE_VECTOR, ipi_reschedule_handler)
 {
     (void)frame;
 
-    uint32_t id = lapic_get_id();
-    if (id < MAX_CPUS && percpu_regions[id] != NULL) {
-        percpu_regions[id]->need_resched = true;
-    }
+    this_cpu()->need_resched = true;
 
     lapic_eoi();
 }
@@ -63,20 +63,7 @@ DEFINE_IRQ(IPI_TLB_SHOOTDOWN, ipi_tlb_shootdown_handler)
 {
     (void)frame;
 
-    uint32_t id = lapic_get_id();
-    tlb_shootdown_t* q = &tlb_shootdown_queue[id];
-
-    if (q->pending) {
-        for (size_t i = 0; i < q->count; i++) {
-            uintptr_t addr = q->addresses[i];
-            if (addr != 0) {
-                asm volatile ("invlpg (%0)" :: "r"(addr) : "memory");
-            }
-        }
-
-        q->pending = false;
-        q->count = 0;
-    }
+    tlb_shootdown_service(this_cpu_id());
 
     lapic_eoi();
 }
\ No newline at end of file
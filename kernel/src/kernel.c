@@ -122,8 +122,8 @@ static void load_elf_module(void) {
         return;
     }
 
-    t->brk_start   = r.load_end;
-    t->brk_current = r.load_end;
+    t->pagemap->brk_start   = r.load_end;
+    t->pagemap->brk_current = r.load_end;
 
     int sr = vfs_init_stdio(t);
     if (sr < 0)
@@ -189,6 +189,7 @@ void kernel_main(void) {
     serial_writestring("GDT&IDT [OK]\n");
     fpu_init();
     sse_init();
+    fpu_xsave_init();
     enable_fsgsbase();
     serial_writestring("FPU/SSE/FSGSBASE [OK]\n");
 
@@ -1,6 +1,7 @@
 #include "../../include/memory/pmm.h"
 #include "../../include/io/serial.h"
 #include "../../include/sched/spinlock.h"
+#include "../../include/smp/percpu.h"
 #include <string.h>
 #include <stdio.h>
 
@@ -32,7 +33,14 @@ static inline void _fl_init(pmm_free_list_t *fl) {
     fl->count      = 0;
 }
 
+static inline page_t *_phys_to_page(uintptr_t phys) {
+    return &g_buddy.pages[phys >> PAGE_SHIFT];
+}
+
 static inline void _fl_push(pmm_free_list_t *fl, pmm_block_t *b, int order) {
+    page_t *pg = _phys_to_page(_block_phys(b));
+    pg->flags  |= PG_FREE;
+    pg->order   = (uint8_t)order;
     b->order        = order;
     b->next         = fl->head.next;
     b->prev         = &fl->head;
@@ -42,6 +50,7 @@ static inline void _fl_push(pmm_free_list_t *fl, pmm_block_t *b, int order) {
 }
 
 static inline void _fl_del(pmm_free_list_t *fl, pmm_block_t *b) {
+    _phys_to_page(_block_phys(b))->flags &= (uint8_t)~PG_FREE;
     b->prev->next = b->next;
     b->next->prev = b->prev;
     b->next = b->prev = NULL;
@@ -53,36 +62,9 @@ static inline pmm_block_t *_fl_first(pmm_free_list_t *fl) {
     return (fl->head.next == &fl->head) ? NULL : fl->head.next;
 }
 
-static inline int _block_ptr_valid(pmm_free_list_t *fl, pmm_block_t *b) {
-    uintptr_t p = (uintptr_t)b;
-    if (p == (uintptr_t)&fl->head) return 1;
-    if (p < g_buddy.hhdm_offset) return 0;
-    uintptr_t phys = p - g_buddy.hhdm_offset;
-    if (phys < g_buddy.mem_start || phys >= g_buddy.mem_end) return 0;
-    if (phys & 0xFFFULL) return 0;
-    return 1;
-}
-
-static pmm_block_t *_fl_find(pmm_free_list_t *fl, uintptr_t phys) {
-    size_t limit = g_buddy.total_pages + 16;
-    pmm_block_t *b = fl->head.next;
-    while (b != &fl->head) {
-        if (!_block_ptr_valid(fl, b)) {
-            serial_printf("[PMM_FREELIST_CORRUPT] bad ptr=%p in freelist walk\n", (void*)b);
-            return NULL;
-        }
-        if (_block_phys(b) == phys) return b;
-        pmm_block_t *next = b->next;
-        if (!_block_ptr_valid(fl, next)) {
-            serial_printf("[PMM_FREELIST_CORRUPT] bad next=%p at block=%p (phys=0x%llx)\n",
-                          (void*)next, (void*)b,
-                          (unsigned long long)_block_phys(b));
-            return NULL;
-        }
-        b = next;
-        if (limit-- == 0) return NULL;
-    }
-    return NULL;
+static inline bool _page_is_free(uintptr_t phys, int order) {
+    page_t *pg = _phys_to_page(phys);
+    return (pg->flags & PG_FREE) && pg->order == (uint8_t)order;
 }
 
 static uintptr_t _buddy_alloc_order(int order) {
@@ -114,12 +96,9 @@ static void _buddy_free_order(uintptr_t phys, int order) {
         if (buddy_phys < g_buddy.mem_start || buddy_phys >= g_buddy.mem_end)
             break;
 
-        pmm_block_t *buddy_b = _fl_find(&g_buddy.orders[order], buddy_phys);
-        if (!buddy_b) break;
-
-        if (buddy_b->order != order) break;
+        if (!_page_is_free(buddy_phys, order)) break;
 
-        _fl_del(&g_buddy.orders[order], buddy_b);
+        _fl_del(&g_buddy.orders[order], _phys_to_block(buddy_phys));
         if (buddy_phys < phys) phys = buddy_phys;
         order++;
     }
@@ -127,6 +106,22 @@ static void _buddy_free_order(uintptr_t phys, int order) {
     g_buddy.free_pages += (size_t)1 << order;
 }
 
+static void _buddy_add_range(uintptr_t base, uintptr_t end) {
+    while (base < end) {
+        size_t rem = (end - base) >> PAGE_SHIFT;
+        int order  = PMM_MAX_ORDER;
+        while (order > 0) {
+            size_t bpages = (size_t)1 << order;
+            if ((base & (bpages * PAGE_SIZE - 1)) == 0 && rem >= bpages)
+                break;
+            order--;
+        }
+        _fl_push(&g_buddy.orders[order], _phys_to_block(base), order);
+        g_buddy.free_pages += (size_t)1 << order;
+        base += (uintptr_t)(PAGE_SIZE << order);
+    }
+}
+
 static void _buddy_free_nocoalesce(uintptr_t phys) {
     _fl_push(&g_buddy.orders[0], _phys_to_block(phys), 0);
     g_buddy.free_pages += 1;
@@ -156,6 +151,25 @@ void pmm_init(struct limine_memmap_response *memmap,
 
     for (int o = 0; o < PMM_MAX_ORDER_NR; o++) _fl_init(&g_buddy.orders[o]);
 
+    size_t    map_bytes = PMM_PAGE_ALIGN(g_buddy.total_pages * sizeof(page_t));
+    uintptr_t map_phys  = 0;
+    for (uint64_t i = 0; i < memmap->entry_count; i++) {
+        struct limine_memmap_entry *e = memmap->entries[i];
+        if (e->type != LIMINE_MEMMAP_USABLE) continue;
+        uintptr_t base = _align_up(e->base, PAGE_SIZE);
+        uintptr_t end  = (e->base + e->length) & ~(PAGE_SIZE - 1);
+        if (base < PMM_FREE_MIN_PHYS) base = PMM_FREE_MIN_PHYS;
+        if (base < end && end - base >= map_bytes) { map_phys = base; break; }
+    }
+    if (!map_phys) {
+        serial_printf("[PMM] no region for %zu-byte page map\n", map_bytes);
+        for (;;) asm volatile("cli; hlt");
+    }
+    g_buddy.pages = (page_t *)(map_phys + g_buddy.hhdm_offset);
+    memset(g_buddy.pages, 0, map_bytes);
+    for (uintptr_t p = map_phys; p < map_phys + map_bytes; p += PAGE_SIZE)
+        _phys_to_page(p)->flags = PG_RESERVED;
+
     for (uint64_t i = 0; i < memmap->entry_count; i++) {
         struct limine_memmap_entry *e = memmap->entries[i];
         if (e->type != LIMINE_MEMMAP_USABLE) continue;
@@ -168,38 +182,151 @@ void pmm_init(struct limine_memmap_response *memmap,
             if (base >= end) continue;
         }
 
-        while (base < end) {
-            size_t rem = (end - base) >> PAGE_SHIFT;
-            int order  = PMM_MAX_ORDER;
-            while (order > 0) {
-                size_t bpages = (size_t)1 << order;
-                if ((base & (bpages * PAGE_SIZE - 1)) == 0 && rem >= bpages)
-                    break;
-                order--;
-            }
-            _fl_push(&g_buddy.orders[order], _phys_to_block(base), order);
-            g_buddy.free_pages += (size_t)1 << order;
-            base += (uintptr_t)(PAGE_SIZE << order);
+        if (map_phys >= base && map_phys < end) {
+            _buddy_add_range(base, map_phys);
+            _buddy_add_range(map_phys + map_bytes, end);
+        } else {
+            _buddy_add_range(base, end);
         }
     }
 
-    serial_printf("[PMM] buddy init: total=%zu free=%zu\n",
-                  g_buddy.total_pages, g_buddy.free_pages);
+    serial_printf("[PMM] buddy init: total=%zu free=%zu page map=%zu KiB at 0x%llx\n",
+                  g_buddy.total_pages, g_buddy.free_pages, map_bytes / 1024,
+                  (unsigned long long)map_phys);
 }
 
 static volatile uint64_t g_pmm_alloc_count = 0;
 static volatile uint64_t g_pmm_free_count  = 0;
 
+static void _pcp_refill(pmm_pcp_t *pcp) {
+    spinlock_acquire(&g_pmm_lock);
+    while (pcp->count < PMM_PCP_BATCH) {
+        uintptr_t phys = _buddy_alloc_order(0);
+        if (!phys) break;
+        _phys_to_page(phys)->flags |= PG_PCP;
+        pcp->pages[pcp->count++] = phys;
+    }
+    spinlock_release(&g_pmm_lock);
+}
+
+static void _pcp_drain(pmm_pcp_t *pcp, uint32_t n) {
+    if (n > pcp->count) n = pcp->count;
+    spinlock_acquire(&g_pmm_lock);
+    for (uint32_t i = 0; i < n; i++) {
+        _phys_to_page(pcp->pages[i])->flags &= (uint8_t)~PG_PCP;
+        _buddy_free_order(pcp->pages[i], 0);
+    }
+    spinlock_release(&g_pmm_lock);
+    pcp->count -= n;
+    memmove(pcp->pages, pcp->pages + n, pcp->count * sizeof(uintptr_t));
+}
+
+static uintptr_t _pcp_alloc(void) {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+    pmm_pcp_t *pcp = &this_cpu()->pcp;
+    spinlock_acquire(&pcp->lock);
+    if (!pcp->count) _pcp_refill(pcp);
+    uintptr_t phys = 0;
+    if (pcp->count) {
+        phys = pcp->pages[--pcp->count];
+        _phys_to_page(phys)->flags &= (uint8_t)~PG_PCP;
+    }
+    spinlock_release(&pcp->lock);
+    asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
+    return phys;
+}
+
+static void _pcp_free(uintptr_t phys) {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+    pmm_pcp_t *pcp = &this_cpu()->pcp;
+    spinlock_acquire(&pcp->lock);
+    if (pcp->count >= PMM_PCP_HIGH) _pcp_drain(pcp, PMM_PCP_BATCH);
+    _phys_to_page(phys)->flags |= PG_PCP;
+    pcp->pages[pcp->count++] = phys;
+    spinlock_release(&pcp->lock);
+    asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
+}
+
+static size_t _pcp_pages(void) {
+    if (!g_percpu_ready) return 0;
+    size_t n = 0;
+    for (uint32_t i = 0; i < smp_get_cpu_count() && i < MAX_CPUS; i++)
+        if (percpu_regions[i])
+            n += __atomic_load_n(&percpu_regions[i]->pcp.count, __ATOMIC_RELAXED);
+    return n;
+}
+
+static spinlock_t       g_zero_lock  = SPINLOCK_INIT;
+static uintptr_t        g_zero_head  = 0;
+static volatile size_t  g_zero_count = 0;
+
+/* Last resort before reporting OOM: pull every CPU's cached pages back
+ * into the buddy lists. The owner only touches its pcp under pcp->lock,
+ * so a remote drain needs no IPI. Caller has IRQs off. */
+static void _pcp_drain_all(void) {
+    if (!g_percpu_ready) return;
+    for (uint32_t i = 0; i < smp_get_cpu_count() && i < MAX_CPUS; i++) {
+        percpu_t *pc = percpu_regions[i];
+        if (!pc || !__atomic_load_n(&pc->pcp.count, __ATOMIC_RELAXED)) continue;
+        spinlock_acquire(&pc->pcp.lock);
+        _pcp_drain(&pc->pcp, PMM_PCP_HIGH);
+        spinlock_release(&pc->pcp.lock);
+    }
+}
+
+static void _zero_pool_drain(void) {
+    spinlock_acquire(&g_zero_lock);
+    uintptr_t phys = g_zero_head;
+    g_zero_head  = 0;
+    g_zero_count = 0;
+    spinlock_release(&g_zero_lock);
+    if (!phys) return;
+    spinlock_acquire(&g_pmm_lock);
+    while (phys) {
+        uintptr_t next = *(uintptr_t *)(phys + g_buddy.hhdm_offset);
+        _phys_to_page(phys)->flags &= (uint8_t)~PG_ZERO;
+        _buddy_free_order(phys, 0);
+        phys = next;
+    }
+    spinlock_release(&g_pmm_lock);
+}
+
+static bool _slab_reclaim(void);
+
+/* Returns true if anything was handed back, i.e. a retry may succeed. */
+static bool _pmm_reclaim(void) {
+    bool freed = _slab_reclaim();
+    if (!freed && !_pcp_pages() && !__atomic_load_n(&g_zero_count, __ATOMIC_RELAXED))
+        return false;
+    _pcp_drain_all();
+    _zero_pool_drain();
+    return true;
+}
+
 void *pmm_alloc(size_t pages) {
     if (!pages) return NULL;
+    if (pages == 1 && g_percpu_ready) {
+        uintptr_t phys = _pcp_alloc();
+        if (phys) {
+            __atomic_fetch_add(&g_pmm_alloc_count, 1, __ATOMIC_RELAXED);
+            return (void *)(phys + g_buddy.hhdm_offset);
+        }
+    }
     int order = _pages_to_order(pages);
     if (order < 0) return NULL;
     uint64_t flags;
     asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
     spinlock_acquire(&g_pmm_lock);
     uintptr_t phys = _buddy_alloc_order(order);
-    size_t free_after = g_buddy.free_pages;
     spinlock_release(&g_pmm_lock);
+    if (!phys && _pmm_reclaim()) {
+        spinlock_acquire(&g_pmm_lock);
+        phys = _buddy_alloc_order(order);
+        spinlock_release(&g_pmm_lock);
+    }
+    size_t free_after = g_buddy.free_pages;
     asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
     if (phys) {
         if (phys < PMM_FREE_MIN_PHYS) {
@@ -219,10 +346,68 @@ void *pmm_alloc(size_t pages) {
     return phys ? (void *)(phys + g_buddy.hhdm_offset) : NULL;
 }
 
+static void _zero_page_nt(void *page) {
+    uint64_t *q = (uint64_t *)page;
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i += 4)
+        asm volatile("movnti %1, 0(%0)\n\t"
+                     "movnti %1, 8(%0)\n\t"
+                     "movnti %1, 16(%0)\n\t"
+                     "movnti %1, 24(%0)"
+                     :: "r"(q + i), "r"(0ULL) : "memory");
+    asm volatile("sfence" ::: "memory");
+}
+
+static void *_zero_pool_pop(void) {
+    if (!__atomic_load_n(&g_zero_count, __ATOMIC_RELAXED)) return NULL;
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+    spinlock_acquire(&g_zero_lock);
+    uintptr_t phys = g_zero_head;
+    if (phys) {
+        uintptr_t *link = (uintptr_t *)(phys + g_buddy.hhdm_offset);
+        g_zero_head = *link;
+        *link = 0;
+        _phys_to_page(phys)->flags &= (uint8_t)~PG_ZERO;
+        g_zero_count--;
+    }
+    spinlock_release(&g_zero_lock);
+    asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
+    return phys ? (void *)(phys + g_buddy.hhdm_offset) : NULL;
+}
+
+void pmm_zero_idle(void) {
+    percpu_t *pc = this_cpu();
+    while (!pc->need_resched &&
+           g_zero_count < PMM_ZERO_POOL_TARGET &&
+           g_buddy.free_pages > PMM_ZERO_POOL_TARGET * 4) {
+        void *page = pmm_alloc(1);
+        if (!page) return;
+        _zero_page_nt(page);
+        uintptr_t phys = (uintptr_t)page - g_buddy.hhdm_offset;
+
+        uint64_t flags;
+        asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+        spinlock_acquire(&g_zero_lock);
+        *(uintptr_t *)page = g_zero_head;
+        g_zero_head = phys;
+        _phys_to_page(phys)->flags |= PG_ZERO;
+        g_zero_count++;
+        spinlock_release(&g_zero_lock);
+        asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
+    }
+}
+
 void *pmm_alloc_zero(size_t pages) {
     if (!pages) return NULL;
     int order = _pages_to_order(pages);
     if (order < 0) return NULL;
+    if (pages == 1) {
+        void *z = _zero_pool_pop();
+        if (z) {
+            __atomic_fetch_add(&g_pmm_alloc_count, 1, __ATOMIC_RELAXED);
+            return z;
+        }
+    }
     void *p = pmm_alloc(pages);
     if (p) memset(p, 0, pages * PAGE_SIZE);
     return p;
@@ -247,6 +432,12 @@ void *pmm_alloc_aligned(size_t pages, size_t alignment) {
     asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
     spinlock_acquire(&g_pmm_lock);
     uintptr_t phys = _buddy_alloc_order(order);
+    if (!phys) {
+        spinlock_release(&g_pmm_lock);
+        bool retry = _pmm_reclaim();
+        spinlock_acquire(&g_pmm_lock);
+        if (retry) phys = _buddy_alloc_order(order);
+    }
     if (!phys) { spinlock_release(&g_pmm_lock); asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc"); return NULL; }
 
     if (phys & (alignment - 1)) {
@@ -277,12 +468,22 @@ void pmm_free(void *addr, size_t pages) {
     int order = _pages_to_order(pages);
     if (order < 0) { serial_printf("[PMM_FREE] bad order pages=%zu\n", pages); return; }
 
+    if (order == 0 && g_percpu_ready) {
+        if (_phys_to_page(phys)->flags & (PG_FREE | PG_RESERVED | PG_PCP | PG_ZERO)) {
+            serial_printf("[PMM_DOUBLE_FREE] addr=%p phys=0x%llx pages=%zu order=0 ALREADY FREE!\n",
+                          addr, (unsigned long long)phys, pages);
+            return;
+        }
+        _pcp_free(phys);
+        __atomic_fetch_add(&g_pmm_free_count, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
     uint64_t flags;
     asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
     spinlock_acquire(&g_pmm_lock);
 
-    pmm_block_t *existing = _fl_find(&g_buddy.orders[order], phys);
-    if (existing) {
+    if (_phys_to_page(phys)->flags & (PG_FREE | PG_RESERVED | PG_PCP | PG_ZERO)) {
         serial_printf("[PMM_DOUBLE_FREE] addr=%p phys=0x%llx pages=%zu order=%d ALREADY FREE!\n",
                       addr, (unsigned long long)phys, pages, order);
         spinlock_release(&g_pmm_lock);
@@ -312,7 +513,11 @@ void pmm_free_single(void *addr) {
     uint64_t flags;
     asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
     spinlock_acquire(&g_pmm_lock);
-    _buddy_free_nocoalesce(phys);
+    if (_phys_to_page(phys)->flags & (PG_FREE | PG_RESERVED | PG_PCP | PG_ZERO))
+        serial_printf("[PMM_DOUBLE_FREE] addr=%p phys=0x%llx ALREADY FREE!\n",
+                      addr, (unsigned long long)phys);
+    else
+        _buddy_free_nocoalesce(phys);
     spinlock_release(&g_pmm_lock);
     asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
 }
@@ -322,9 +527,11 @@ uintptr_t pmm_virt_to_phys(void *vaddr)      { return (uintptr_t)vaddr - g_buddy
 uint64_t  pmm_get_hhdm_offset(void)          { return g_buddy.hhdm_offset; }
 size_t    pmm_get_total_pages(void)           { return g_buddy.total_pages; }
 size_t    pmm_get_usable_pages(void)          { return g_buddy.usable_pages; }
-size_t    pmm_get_free_pages(void)            { return g_buddy.free_pages; }
-size_t    pmm_get_used_pages(void)            { return g_buddy.usable_pages > g_buddy.free_pages
-                                                       ? g_buddy.usable_pages - g_buddy.free_pages : 0; }
+size_t    pmm_get_free_pages(void)            { return g_buddy.free_pages + _pcp_pages() + g_zero_count; }
+size_t    pmm_get_used_pages(void) {
+    size_t free = pmm_get_free_pages();
+    return g_buddy.usable_pages > free ? g_buddy.usable_pages - free : 0;
+}
 
 static void _print_size(size_t bytes, const char *label) {
     uint64_t v = (uint64_t)bytes;
@@ -354,7 +561,7 @@ static void _print_size(size_t bytes, const char *label) {
 
 void pmm_print_stats(void) {
     size_t usable_bytes = g_buddy.usable_pages * PAGE_SIZE;
-    size_t free_bytes   = g_buddy.free_pages   * PAGE_SIZE;
+    size_t free_bytes   = pmm_get_free_pages() * PAGE_SIZE;
     size_t total_bytes  = g_buddy.total_pages  * PAGE_SIZE;
     size_t used_bytes   = usable_bytes > free_bytes   ? usable_bytes - free_bytes   : 0;
     size_t reserved     = total_bytes  > usable_bytes ? total_bytes  - usable_bytes : 0;
@@ -377,37 +584,90 @@ void pmm_print_stats(void) {
                           o, (PAGE_SIZE << o) / 1024,
                           g_buddy.orders[o].count);
     }
+    serial_printf("[PMM] per-cpu page caches: %zu pages, zeroed pool: %zu pages\n",
+                  _pcp_pages(), (size_t)g_zero_count);
 }
 
 #define SLAB_PAGE_ALLOC(n)   pmm_alloc_zero(n)
 #define SLAB_PAGE_FREE(p, n) pmm_free(p, n)
+#define SLAB_COLOR_STEP      64
 
 static const size_t g_size_classes[SLAB_NUM_CACHES] = {
     8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096
 };
 
+static const char *const g_size_names[SLAB_NUM_CACHES] = {
+    "kmalloc-8", "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1k", "kmalloc-2k", "kmalloc-4k"
+};
+
 slab_cache_t g_caches[SLAB_NUM_CACHES];
 
+static spinlock_t    g_cache_list_lock = SPINLOCK_INIT;
+static slab_cache_t *g_cache_list      = NULL;
+static int           g_next_cache_id   = SLAB_NUM_CACHES;
+
+static inline size_t _color_step(const slab_cache_t *c) {
+    return c->align > SLAB_COLOR_STEP ? c->align : SLAB_COLOR_STEP;
+}
+
 static inline uintptr_t _slab_obj_start(slab_t *s) {
-    return _align_up((uintptr_t)s + sizeof(slab_t), 8);
+    return _align_up((uintptr_t)s + sizeof(slab_t), s->cache->align)
+         + (uintptr_t)s->color * _color_step(s->cache);
+}
+
+static void _cache_layout(slab_cache_t *c) {
+    uintptr_t hdr = _align_up(sizeof(slab_t), c->align);
+    for (int order = 0; order <= SLAB_MAX_ORDER; order++) {
+        size_t bytes = PAGE_SIZE << order;
+        size_t cap   = bytes > hdr ? (bytes - hdr) / c->obj_size : 0;
+        if (cap > 0xFFFF) cap = 0xFFFF;
+        c->order    = (uint16_t)order;
+        c->capacity = (uint16_t)cap;
+        if (!cap) continue;
+        size_t left = bytes - hdr - cap * c->obj_size;
+        c->color_max = (uint16_t)(left / _color_step(c));
+        if (left * 8 <= bytes || cap >= 8) break;
+    }
+    if (!c->capacity) c->color_max = 0;
 }
 
-static inline size_t _slab_pages(size_t obj_size) {
-    uintptr_t hdr_end = _align_up(sizeof(slab_t), 8);
-    if (obj_size <= PAGE_SIZE - hdr_end)
-        return 1;
-    if (obj_size <= PAGE_SIZE)
-        return 2;
-    return 0;
+static void _cache_setup(slab_cache_t *c, const char *name, size_t size,
+                         size_t align, void (*ctor)(void *)) {
+    if (align < 8) align = 8;
+    if (align & (align - 1)) {
+        size_t a = 8;
+        while (a < align) a <<= 1;
+        align = a;
+    }
+    memset(c, 0, sizeof(*c));
+    c->name       = name;
+    c->align      = align;
+    if (ctor) {
+        c->link_off = _align_up(size, sizeof(void *));
+        c->obj_size = _align_up(c->link_off + sizeof(void *), align);
+    } else {
+        c->link_off = 0;
+        c->obj_size = _align_up(size < sizeof(void *) ? sizeof(void *) : size, align);
+    }
+    c->ctor       = ctor;
+    c->lock       = (spinlock_t)SPINLOCK_INIT;
+    c->depot_lock = (spinlock_t)SPINLOCK_INIT;
+    _cache_layout(c);
 }
 
-static inline uint16_t _slab_capacity(size_t obj_size) {
-    size_t pages = _slab_pages(obj_size);
-    if (pages == 0) return 0;
-    uintptr_t obj_start = _align_up(sizeof(slab_t), 8);
-    size_t avail = pages * PAGE_SIZE - obj_start;
-    uint16_t cap = (uint16_t)(avail / obj_size);
-    return cap > 0 ? cap : 0;
+static inline slab_t *_slab_of(const void *ptr) {
+    uintptr_t v = (uintptr_t)ptr;
+    if (v < g_buddy.hhdm_offset) return NULL;
+    uintptr_t phys = v - g_buddy.hhdm_offset;
+    if (phys >= g_buddy.mem_end) return NULL;
+    page_t *pg = _phys_to_page(phys);
+    if (!(pg->flags & PG_SLAB)) return NULL;
+    return (slab_t *)(v & ~(((uintptr_t)PAGE_SIZE << pg->order) - 1));
+}
+
+static inline void **_obj_link(const slab_cache_t *cache, void *obj) {
+    return (void **)((uintptr_t)obj + cache->link_off);
 }
 
 static void _slab_list_push(slab_t **head, slab_t *s) {
@@ -424,30 +684,47 @@ static void _slab_list_remove(slab_t **head, slab_t *s) {
 }
 
 static slab_t *_slab_new(slab_cache_t *cache) {
-    uint16_t cap = _slab_capacity(cache->obj_size);
-    if (!cap) return NULL;
-
-    size_t pages = _slab_pages(cache->obj_size);
+    if (!cache->capacity) return NULL;
 
+    size_t pages = (size_t)1 << cache->order;
     slab_t *s = (slab_t *)SLAB_PAGE_ALLOC(pages);
     if (!s) return NULL;
 
+    uintptr_t phys = (uintptr_t)s - g_buddy.hhdm_offset;
+    for (size_t i = 0; i < pages; i++) {
+        page_t *pg = _phys_to_page(phys + i * PAGE_SIZE);
+        pg->flags |= PG_SLAB;
+        pg->order  = (uint8_t)cache->order;
+    }
+
+    s->cache    = cache;
     s->obj_size = (uint16_t)cache->obj_size;
-    s->total    = cap;
+    s->total    = cache->capacity;
     s->used     = 0;
     s->next     = s->prev = NULL;
+    s->color    = cache->color_next;
+    cache->color_next = cache->color_next < cache->color_max ? cache->color_next + 1 : 0;
 
     uintptr_t start = _slab_obj_start(s);
     s->freelist = (void *)start;
     for (uint16_t i = 0; i < s->total; i++) {
-        void **slot = (void **)(start + (uintptr_t)i * cache->obj_size);
-        *slot = (i + 1 < s->total)
+        void *obj = (void *)(start + (uintptr_t)i * cache->obj_size);
+        *_obj_link(cache, obj) = (i + 1 < s->total)
                 ? (void *)(start + (uintptr_t)(i + 1) * cache->obj_size)
                 : NULL;
+        if (cache->ctor) cache->ctor(obj);
     }
     return s;
 }
 
+static void _slab_release(slab_t *s) {
+    size_t pages = (size_t)1 << s->cache->order;
+    uintptr_t phys = (uintptr_t)s - g_buddy.hhdm_offset;
+    for (size_t i = 0; i < pages; i++)
+        _phys_to_page(phys + i * PAGE_SIZE)->flags &= (uint8_t)~PG_SLAB;
+    SLAB_PAGE_FREE(s, pages);
+}
+
 #define LARGE_ALLOC_MAGIC 0xDEADBEEFCAFEBABEULL
 
 typedef struct {
@@ -460,60 +737,51 @@ static inline bool _is_large_alloc(void *ptr) {
     return hdr->magic == LARGE_ALLOC_MAGIC;
 }
 
-static slab_cache_t *_cache_for(size_t size) {
-    for (int i = 0; i < SLAB_NUM_CACHES; i++)
-        if (g_caches[i].obj_size >= size) return &g_caches[i];
-    return NULL;
+static inline int _cache_index(size_t size) {
+    if (size <= SLAB_MIN_SIZE) return 0;
+    return 64 - __builtin_clzll((unsigned long long)(size - 1)) - 3;
+}
+
+_Static_assert(sizeof(slab_magazine_t) <= SLAB_MAX_SIZE, "slab: magazine too large");
+
+static void _cache_link(slab_cache_t *c) {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+    spinlock_acquire(&g_cache_list_lock);
+    c->next_cache = g_cache_list;
+    g_cache_list  = c;
+    spinlock_release(&g_cache_list_lock);
+    asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
 }
 
 void slab_init(void) {
     for (int i = 0; i < SLAB_NUM_CACHES; i++) {
-        g_caches[i].obj_size     = g_size_classes[i];
-        g_caches[i].partial      = NULL;
-        g_caches[i].full         = NULL;
-        g_caches[i].total_allocs = 0;
-        g_caches[i].total_frees  = 0;
+        _cache_setup(&g_caches[i], g_size_names[i], g_size_classes[i], 8, NULL);
+        g_caches[i].id = i;
+        _cache_link(&g_caches[i]);
     }
-    serial_printf("[PMM] slab init: %d caches, sizes 8..4096 bytes\n",
-                  SLAB_NUM_CACHES);
+    serial_printf("[PMM] slab init: %d caches, sizes 8..4096 bytes, %d-round magazines\n",
+                  SLAB_NUM_CACHES, SLAB_MAG_ROUNDS);
 }
 
-static spinlock_t g_slab_lock = SPINLOCK_INIT;
-
-void *kmalloc(size_t size) {
-    if (!size) return NULL;
+static void *_slab_alloc(slab_cache_t *cache) {
     uint64_t flags;
     asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
-    spinlock_acquire(&g_slab_lock);
-
-    void *result;
-    if (size > SLAB_MAX_SIZE) {
-        size_t pages = (size + sizeof(large_hdr_t) + PAGE_SIZE - 1) / PAGE_SIZE;
-        spinlock_release(&g_slab_lock);
-        asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
-        large_hdr_t *hdr = (large_hdr_t *)SLAB_PAGE_ALLOC(pages);
-        if (!hdr) return NULL;
-        hdr->magic = LARGE_ALLOC_MAGIC;
-        hdr->pages = (uint64_t)pages;
-        return (void *)(hdr + 1);
-    }
-
-    slab_cache_t *cache = _cache_for(size);
-    if (!cache) { spinlock_release(&g_slab_lock); asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc"); return NULL; }
+    spinlock_acquire(&cache->lock);
 
     if (!cache->partial) {
-        spinlock_release(&g_slab_lock);
+        spinlock_release(&cache->lock);
         asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
         slab_t *s = _slab_new(cache);
         if (!s) return NULL;
         asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
-        spinlock_acquire(&g_slab_lock);
+        spinlock_acquire(&cache->lock);
         _slab_list_push(&cache->partial, s);
     }
     slab_t *s = cache->partial;
 
     void *obj   = s->freelist;
-    s->freelist = *(void **)obj;
+    s->freelist = *_obj_link(cache, obj);
     s->used++;
     cache->total_allocs++;
 
@@ -521,46 +789,24 @@ void *kmalloc(size_t size) {
         _slab_list_remove(&cache->partial, s);
         _slab_list_push(&cache->full, s);
     }
-    result = obj;
-    spinlock_release(&g_slab_lock);
+    spinlock_release(&cache->lock);
     asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
-    return result;
-}
-
-void *kzalloc(size_t size) {
-    void *p = kmalloc(size);
-    if (p) memset(p, 0, size);
-    return p;
+    return obj;
 }
 
-void kfree(void *ptr) {
-    if (!ptr) return;
-
-    if (_is_large_alloc(ptr)) {
-        large_hdr_t *hdr = (large_hdr_t *)ptr - 1;
-        size_t pages = (size_t)hdr->pages;
-        hdr->magic = 0;
-        SLAB_PAGE_FREE(hdr, pages);
+static void _slab_free(slab_cache_t *cache, void *ptr) {
+    slab_t *s = _slab_of(ptr);
+    if (!s || s->cache != cache) {
+        serial_printf("[SLAB] free of %p to wrong cache '%s'\n", ptr, cache->name);
         return;
     }
 
     uint64_t flags;
     asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
-    spinlock_acquire(&g_slab_lock);
-
-    slab_t *s = (slab_t *)((uintptr_t)ptr & ~((uintptr_t)PAGE_SIZE - 1));
-
-    slab_cache_t *cache = NULL;
-    for (int i = 0; i < SLAB_NUM_CACHES; i++) {
-        if (g_caches[i].obj_size == s->obj_size) {
-            cache = &g_caches[i];
-            break;
-        }
-    }
-    if (!cache) { spinlock_release(&g_slab_lock); asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc"); return; }
+    spinlock_acquire(&cache->lock);
 
     bool was_full = (s->used == s->total);
-    *(void **)ptr = s->freelist;
+    *_obj_link(cache, ptr) = s->freelist;
     s->freelist   = ptr;
     s->used--;
     cache->total_frees++;
@@ -571,14 +817,249 @@ void kfree(void *ptr) {
     }
     if (s->used == 0) {
         _slab_list_remove(&cache->partial, s);
-        size_t pages = _slab_pages(s->obj_size);
-        spinlock_release(&g_slab_lock);
+        spinlock_release(&cache->lock);
         asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
-        SLAB_PAGE_FREE(s, pages > 0 ? pages : 1);
+        _slab_release(s);
         return;
     }
-    spinlock_release(&g_slab_lock);
+    spinlock_release(&cache->lock);
+    asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
+}
+
+static inline slab_cache_t *_mag_cache(void) {
+    return &g_caches[_cache_index(sizeof(slab_magazine_t))];
+}
+
+static slab_magazine_t *_mag_new(void) {
+    slab_magazine_t *m = _slab_alloc(_mag_cache());
+    if (m) { m->next = NULL; m->rounds = 0; }
+    return m;
+}
+
+static inline void _mag_push(slab_magazine_t **head, size_t *n, slab_magazine_t *m) {
+    m->next = *head;
+    *head   = m;
+    (*n)++;
+}
+
+static inline slab_magazine_t *_mag_pop(slab_magazine_t **head, size_t *n) {
+    slab_magazine_t *m = *head;
+    if (m) { *head = m->next; m->next = NULL; (*n)--; }
+    return m;
+}
+
+static void _mag_flush(slab_cache_t *cache, slab_magazine_t *m) {
+    while (m->rounds)
+        _slab_free(cache, m->objs[--m->rounds]);
+}
+
+static inline void _mag_swap(slab_cpu_t *cc) {
+    slab_magazine_t *t = cc->loaded;
+    cc->loaded = cc->prev;
+    cc->prev   = t;
+}
+
+/* Empty every cache's depot back into its slabs so fully free slabs go
+ * back to the page allocator. Only the depots are flushed: a CPU's
+ * loaded/prev magazines are touched without a lock, and the local pair
+ * may be mid-swap when an allocation below _mag_free() lands here. That
+ * leaves at most two magazines per CPU per cache outstanding. Caches are
+ * never unlinked, so the list is walked from a snapshot of its head
+ * without holding g_cache_list_lock across pmm_free(). Caller has IRQs
+ * off and holds no allocator lock. */
+static bool _slab_reclaim(void) {
+    spinlock_acquire(&g_cache_list_lock);
+    slab_cache_t *head = g_cache_list;
+    spinlock_release(&g_cache_list_lock);
+
+    bool freed = false;
+    for (slab_cache_t *c = head; c; c = c->next_cache) {
+        if (!__atomic_load_n(&c->depot_nfull, __ATOMIC_RELAXED) &&
+            !__atomic_load_n(&c->depot_nempty, __ATOMIC_RELAXED))
+            continue;
+        spinlock_acquire(&c->depot_lock);
+        slab_magazine_t *full  = c->depot_full;
+        slab_magazine_t *empty = c->depot_empty;
+        c->depot_full  = c->depot_empty  = NULL;
+        c->depot_nfull = c->depot_nempty = 0;
+        spinlock_release(&c->depot_lock);
+
+        while (full) {
+            slab_magazine_t *m = full;
+            full = m->next;
+            _mag_flush(c, m);
+            _slab_free(_mag_cache(), m);
+            freed = true;
+        }
+        while (empty) {
+            slab_magazine_t *m = empty;
+            empty = m->next;
+            _slab_free(_mag_cache(), m);
+            freed = true;
+        }
+    }
+    return freed;
+}
+
+static void *_mag_alloc(slab_cache_t *cache) {
+    void *obj = NULL;
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+    slab_cpu_t *cc = &this_cpu()->slab[cache->id];
+
+    if (!(cc->loaded && cc->loaded->rounds) && cc->prev && cc->prev->rounds)
+        _mag_swap(cc);
+
+    if (!(cc->loaded && cc->loaded->rounds)) {
+        slab_magazine_t *drop = NULL;
+        spinlock_acquire(&cache->depot_lock);
+        slab_magazine_t *full = _mag_pop(&cache->depot_full, &cache->depot_nfull);
+        if (full && cc->prev) {
+            if (cache->depot_nempty < SLAB_DEPOT_MAX)
+                _mag_push(&cache->depot_empty, &cache->depot_nempty, cc->prev);
+            else
+                drop = cc->prev;
+        }
+        spinlock_release(&cache->depot_lock);
+        if (full) {
+            cc->prev   = cc->loaded;
+            cc->loaded = full;
+        }
+        if (drop) _slab_free(_mag_cache(), drop);
+    }
+
+    if (cc->loaded && cc->loaded->rounds) {
+        obj = cc->loaded->objs[--cc->loaded->rounds];
+        cc->allocs++;
+    }
+    asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
+    return obj;
+}
+
+static bool _mag_free(slab_cache_t *cache, void *ptr) {
+    bool ok = false;
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+    slab_cpu_t *cc = &this_cpu()->slab[cache->id];
+
+    if (!(cc->loaded && cc->loaded->rounds < SLAB_MAG_ROUNDS) &&
+        cc->prev && cc->prev->rounds < SLAB_MAG_ROUNDS)
+        _mag_swap(cc);
+
+    if (!(cc->loaded && cc->loaded->rounds < SLAB_MAG_ROUNDS)) {
+        slab_magazine_t *full  = cc->prev;
+        slab_magazine_t *empty = NULL;
+        cc->prev = cc->loaded;
+        spinlock_acquire(&cache->depot_lock);
+        if (full && cache->depot_nfull < SLAB_DEPOT_MAX) {
+            _mag_push(&cache->depot_full, &cache->depot_nfull, full);
+            full = NULL;
+        }
+        if (!full) empty = _mag_pop(&cache->depot_empty, &cache->depot_nempty);
+        spinlock_release(&cache->depot_lock);
+        if (full) {
+            _mag_flush(cache, full);
+            empty = full;
+        }
+        cc->loaded = empty ? empty : _mag_new();
+    }
+
+    if (cc->loaded) {
+        cc->loaded->objs[cc->loaded->rounds++] = ptr;
+        cc->frees++;
+        ok = true;
+    }
     asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
+    return ok;
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align,
+                                void (*ctor)(void *obj)) {
+    if (!size) return NULL;
+    slab_cache_t *c = kmalloc(sizeof(slab_cache_t));
+    if (!c) return NULL;
+    _cache_setup(c, name, size, align, ctor);
+    if (!c->capacity) {
+        serial_printf("[SLAB] cache '%s': object size %zu too large\n", name, size);
+        kfree(c);
+        return NULL;
+    }
+
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+    spinlock_acquire(&g_cache_list_lock);
+    c->id = g_next_cache_id < SLAB_MAX_CACHES ? g_next_cache_id++ : -1;
+    spinlock_release(&g_cache_list_lock);
+    asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
+    _cache_link(c);
+
+    serial_printf("[SLAB] cache '%s': obj=%zu align=%zu slab=%zu KiB cap=%u colours=%u\n",
+                  name, c->obj_size, c->align, (PAGE_SIZE << c->order) / 1024,
+                  c->capacity, c->color_max + 1);
+    return c;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+    if (!cache) return NULL;
+    if (g_percpu_ready && cache->id >= 0) {
+        void *obj = _mag_alloc(cache);
+        if (obj) return obj;
+    }
+    return _slab_alloc(cache);
+}
+
+void *kmem_cache_zalloc(kmem_cache_t *cache) {
+    if (cache && cache->ctor) {
+        serial_printf("[SLAB] zalloc from ctor cache '%s' refused\n", cache->name);
+        return NULL;
+    }
+    void *obj = kmem_cache_alloc(cache);
+    if (obj) memset(obj, 0, cache->obj_size);
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+    if (!cache || !obj) return;
+    if (g_percpu_ready && cache->id >= 0 && _mag_free(cache, obj)) return;
+    _slab_free(cache, obj);
+}
+
+void *kmalloc(size_t size) {
+    if (!size) return NULL;
+
+    if (size > SLAB_MAX_SIZE) {
+        size_t pages = (size + sizeof(large_hdr_t) + PAGE_SIZE - 1) / PAGE_SIZE;
+        large_hdr_t *hdr = (large_hdr_t *)SLAB_PAGE_ALLOC(pages);
+        if (!hdr) return NULL;
+        hdr->magic = LARGE_ALLOC_MAGIC;
+        hdr->pages = (uint64_t)pages;
+        return (void *)(hdr + 1);
+    }
+
+    return kmem_cache_alloc(&g_caches[_cache_index(size)]);
+}
+
+void *kzalloc(size_t size) {
+    void *p = kmalloc(size);
+    if (p) memset(p, 0, size);
+    return p;
+}
+
+void kfree(void *ptr) {
+    if (!ptr) return;
+
+    slab_t *s = _slab_of(ptr);
+    if (s) {
+        kmem_cache_free(s->cache, ptr);
+        return;
+    }
+
+    if (_is_large_alloc(ptr)) {
+        large_hdr_t *hdr = (large_hdr_t *)ptr - 1;
+        size_t pages = (size_t)hdr->pages;
+        hdr->magic = 0;
+        SLAB_PAGE_FREE(hdr, pages);
+    }
 }
 
 void *krealloc(void *ptr, size_t new_size) {
@@ -586,12 +1067,14 @@ void *krealloc(void *ptr, size_t new_size) {
     if (!new_size) { kfree(ptr); return NULL; }
 
     size_t old_size;
-    if (_is_large_alloc(ptr)) {
+    slab_t *s = _slab_of(ptr);
+    if (s) {
+        old_size = s->obj_size;
+    } else if (_is_large_alloc(ptr)) {
         large_hdr_t *hdr = (large_hdr_t *)ptr - 1;
         old_size = (size_t)hdr->pages * PAGE_SIZE - sizeof(large_hdr_t);
     } else {
-        slab_t *s = (slab_t *)((uintptr_t)ptr & ~((uintptr_t)PAGE_SIZE - 1));
-        old_size = s->obj_size;
+        return NULL;
     }
 
     void *np = kmalloc(new_size);
@@ -603,12 +1086,18 @@ void *krealloc(void *ptr, size_t new_size) {
 
 void slab_print_stats(void) {
     serial_printf("[PMM] slab stats:\n");
-    for (int i = 0; i < SLAB_NUM_CACHES; i++) {
-        slab_cache_t *c = &g_caches[i];
+    for (slab_cache_t *c = g_cache_list; c; c = c->next_cache) {
         size_t np = 0, nf = 0;
         for (slab_t *s = c->partial; s && np < 10000; s = s->next) np++;
         for (slab_t *s = c->full;    s && nf < 10000; s = s->next) nf++;
-        serial_printf("  [%4zu B] partial=%zu full=%zu allocs=%zu frees=%zu\n",
-                      c->obj_size, np, nf, c->total_allocs, c->total_frees);
+        size_t ma = 0, mf = 0;
+        for (uint32_t cpu = 0; c->id >= 0 && cpu < smp_get_cpu_count() && cpu < MAX_CPUS; cpu++) {
+            if (!percpu_regions[cpu]) continue;
+            ma += percpu_regions[cpu]->slab[c->id].allocs;
+            mf += percpu_regions[cpu]->slab[c->id].frees;
+        }
+        serial_printf("  %-14s [%4zu B] partial=%zu full=%zu allocs=%zu frees=%zu mag=%zu/%zu depot=%zu/%zu\n",
+                      c->name, c->obj_size, np, nf, c->total_allocs, c->total_frees,
+                      ma, mf, c->depot_nfull, c->depot_nempty);
     }
-}
\ No newline at end of file
+}
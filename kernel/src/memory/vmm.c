@@ -2,6 +2,7 @@
 #include "../../include/memory/pmm.h"
 #include "../../include/smp/smp.h"
 #include "../../include/apic/apic.h"
+#include "../../include/smp/percpu.h"
 #include "../../include/io/serial.h"
 #include <stdio.h>
 #include <string.h>
@@ -98,8 +99,11 @@ void vmm_unmap_page(vmm_pagemap_t* map, uintptr_t virt) {
     pt[pt_i] = 0;
     asm volatile ("lock addl $0, (%%rsp)" ::: "memory", "cc");
     invlpg((void*)virt);
-    if (smp_get_cpu_count() > 1 && (virt >= 0xffff800000000000ULL)) {
-        ipi_tlb_shootdown_broadcast(&virt, 1);
+    if (smp_get_cpu_count() > 1) {
+        if (virt >= 0xffff800000000000ULL)
+            ipi_tlb_shootdown_broadcast(&virt, 1);
+        else
+            ipi_tlb_shootdown_mask(map->cpu_mask, MAX_CPUS / 64, virt);
     }
 
     if (phys >= PMM_FREE_MIN_PHYS) {
@@ -125,10 +129,26 @@ vmm_pagemap_t* vmm_create_pagemap(void) {
         map->pml4[i] = kernel_pagemap.pml4[i];
     }
 
+    map->refcount = 1;
+    map->brk_max  = VMM_USER_BRK_MAX;
     return map;
 }
 
+void vmm_pagemap_activate(vmm_pagemap_t* map) {
+    if (!g_percpu_ready) return;
+    if (map == &kernel_pagemap) map = NULL;
+    percpu_t* pc = this_cpu();
+    vmm_pagemap_t* prev = pc->active_pagemap;
+    if (prev == map) return;
+    uint32_t cpu = pc->cpu_id;
+    uint64_t bit = 1ULL << (cpu % 64);
+    if (map)  __atomic_fetch_or(&map->cpu_mask[cpu / 64], bit, __ATOMIC_SEQ_CST);
+    if (prev) __atomic_fetch_and(&prev->cpu_mask[cpu / 64], ~bit, __ATOMIC_RELEASE);
+    pc->active_pagemap = map;
+}
+
 void vmm_switch_pagemap(vmm_pagemap_t* map) {
+    vmm_pagemap_activate(map);
     uintptr_t phys = pmm_virt_to_phys(map->pml4);
     asm volatile ("mov %0, %%cr3" :: "r"(phys) : "memory");
 }
@@ -182,6 +202,10 @@ vmm_pagemap_t* vmm_clone_pagemap(vmm_pagemap_t* src) {
     vmm_pagemap_t* dst = pmm_alloc_zero(1);
     if (!dst) return NULL;
     dst->pml4 = alloc_table();
+    dst->refcount    = 1;
+    dst->brk_start   = src->brk_start;
+    dst->brk_current = src->brk_current;
+    dst->brk_max     = src->brk_max;
 
     for (size_t i = 256; i < 512; i++)
         dst->pml4[i] = kernel_pagemap.pml4[i];
@@ -287,6 +311,16 @@ void vmm_free_pagemap(vmm_pagemap_t* map)
     pmm_free(map->pml4, 1);
     pmm_free(map, 1);
 }
+
+void vmm_pagemap_get(vmm_pagemap_t* map) {
+    if (map) __atomic_fetch_add(&map->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void vmm_pagemap_put(vmm_pagemap_t* map) {
+    if (!map) return;
+    if (__atomic_sub_fetch(&map->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+        vmm_free_pagemap(map);
+}
 uintptr_t kernel_pml4_phys;
 
 void vmm_init(void) {
@@ -0,0 +1,59 @@
+#include "../include/sched/futex.h"
+#include "../include/sched/sched.h"
+#include "../include/sched/wait.h"
+#include "../include/smp/percpu.h"
+#include "../include/memory/pmm.h"
+#include "../include/memory/vmm.h"
+#include "../include/apic/apic.h"
+#include "../include/syscall/errno.h"
+
+static wait_queue_t futex_table[FUTEX_HASH_SIZE];
+
+static inline wait_queue_t* futex_bucket(uint64_t key) {
+    return &futex_table[((key >> 2) * 0x9E3779B97F4A7C15ULL) >> (64 - FUTEX_HASH_BITS)];
+}
+
+static int futex_key(task_t* t, uintptr_t uaddr, uint64_t* key) {
+    if (!t || !t->pagemap || (uaddr & 3)) return -EINVAL;
+    uintptr_t phys;
+    if (!vmm_virt_to_phys(t->pagemap, uaddr, &phys)) return -EFAULT;
+    *key = phys;
+    return 0;
+}
+
+int64_t futex_wait(uintptr_t uaddr, uint32_t expected, uint64_t timeout_ns) {
+    percpu_t* pc = get_percpu();
+    task_t* me = pc ? (task_t*)pc->current_task : NULL;
+    uint64_t key;
+    int r = futex_key(me, uaddr, &key);
+    if (r < 0) return r;
+
+    if (timeout_ns && !hpet_is_available()) return -ENOSYS;
+    uint64_t deadline = timeout_ns ? hpet_elapsed_ns() + timeout_ns : 0;
+
+    wait_queue_t* wq = futex_bucket(key);
+    wait_entry_t  w  = { .key = key };
+    wait_prepare(wq, &w);
+    if (*(volatile uint32_t*)pmm_phys_to_virt(key) != expected) {
+        wait_finish(wq, &w);
+        return -EAGAIN;
+    }
+    if (me->pending_kill) {
+        wait_finish(wq, &w);
+        return -EINTR;
+    }
+    wait_sleep_until(&w, deadline);
+    if (!wait_finish(wq, &w)) return 0;
+    if (me->pending_kill) return -EINTR;
+    return deadline ? -ETIMEDOUT : -EINTR;
+}
+
+int64_t futex_wake(uintptr_t uaddr, uint32_t nr) {
+    percpu_t* pc = get_percpu();
+    task_t* me = pc ? (task_t*)pc->current_task : NULL;
+    uint64_t key;
+    int r = futex_key(me, uaddr, &key);
+    if (r < 0) return r;
+    if (!nr) return 0;
+    return wait_wake_key(futex_bucket(key), key, nr > 0x7FFFFFFF ? 0x7FFFFFFF : (int)nr);
+}
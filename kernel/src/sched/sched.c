@@ -1,5 +1,6 @@
 #include "../include/sched/capabilities.h"
 #include "../include/sched/sched.h"
+#include "../include/sched/sched_trace.h"
 #include "../include/sched/spinlock.h"
 #include "../include/memory/pmm.h"
 #include "../include/memory/vmm.h"
@@ -7,25 +8,34 @@
 #include "../include/smp/smp.h"
 #include "../include/smp/percpu.h"
 #include "../include/apic/apic.h"
+#include "../include/drivers/timer.h"
 #include "../include/gdt/gdt.h"
 #include "../include/fs/vfs.h"
 #include "../include/panic/panic.h"
+#include "../include/sse/fpu.h"
+#include "../include/syscall/syscall_nums.h"
 #include <string.h>
 #include <stdlib.h>
 
 #define KERNEL_STACK_PAGES (KERNEL_STACK_SIZE / 0x1000)
-#define MAX_PIDS 4096
+#define MAX_PIDS   32768
+#define PID_WORDS  (MAX_PIDS / 64)
 
-task_t* ready_queues[MAX_PRIORITY + 1] = {0};
 task_t* current_task[MAX_CPUS] = {0};
 
 static task_t  idle_tasks[MAX_CPUS];
 static task_t  bootstrap_tasks[MAX_CPUS];
 static volatile uint64_t reschedule_calls = 0;
-static spinlock_t ready_queue_lock = SPINLOCK_INIT;
+static volatile uint64_t steal_count = 0;
+static volatile uint64_t rt_wakeups = 0;
+static volatile uint64_t rt_latency_max_ns = 0;
 static task_t*    pid_table[MAX_PIDS] = {0};
-static uint32_t   next_pid = 1;
-static spinlock_t pid_lock = SPINLOCK_INIT;
+static uint64_t   pid_bitmap[PID_WORDS] = { 1 };
+static volatile uint32_t next_pid = 1;
+static volatile uint64_t rcu_gp_seq = 0;
+static spinlock_t retire_lock = SPINLOCK_INIT;
+static task_t*    retire_head = NULL;
+static task_t*    retire_tail = NULL;
 
 spinlock_t children_lock = SPINLOCK_INIT;
 
@@ -39,51 +49,202 @@ static inline void fix_gs_base(percpu_t* pc) {
                     "d"((uint32_t)(val >> 32)));
 }
 
+#define MSR_FS_BASE 0xC0000100U
+
+static inline uint64_t fs_base_read(void) {
+    if (g_has_fsgsbase) {
+        uint64_t v;
+        asm volatile("rdfsbase %0" : "=r"(v));
+        return v;
+    }
+    uint32_t lo, hi;
+    asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(MSR_FS_BASE));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void fs_base_write(uint64_t val) {
+    if (g_has_fsgsbase) {
+        asm volatile("wrfsbase %0" :: "r"(val) : "memory");
+        return;
+    }
+    asm volatile("wrmsr"
+                 :: "c"(MSR_FS_BASE),
+                    "a"((uint32_t)val),
+                    "d"((uint32_t)(val >> 32)));
+}
+
+void task_set_fs_base(task_t* t, uint64_t base) {
+    t->fs_base = base;
+    percpu_t* pc = get_percpu();
+    if (pc && pc->current_task == t) fs_base_write(base);
+}
+
 uint32_t task_alloc_pid(void) {
-    uint64_t _irqf;
-    _irqf = spinlock_acquire_irqsave(&pid_lock);
-    uint32_t found = 0;
-    for (uint32_t attempt = 0; attempt < MAX_PIDS - 1; attempt++) {
-        uint32_t i = next_pid;
-        if (i == 0 || i >= MAX_PIDS) {
-            next_pid = 1;
-            i = 1;
+    uint32_t hint = __atomic_load_n(&next_pid, __ATOMIC_RELAXED);
+    uint32_t start = (hint % MAX_PIDS) / 64;
+    for (uint32_t n = 0; n <= PID_WORDS; n++) {
+        uint32_t w = (start + n) % PID_WORDS;
+        uint64_t mask = (n == 0) ? (~0ULL << (hint % 64)) : ~0ULL;
+        uint64_t cur = __atomic_load_n(&pid_bitmap[w], __ATOMIC_RELAXED);
+        while (~cur & mask) {
+            uint32_t bit = (uint32_t)__builtin_ctzll(~cur & mask);
+            if (__atomic_compare_exchange_n(&pid_bitmap[w], &cur, cur | (1ULL << bit),
+                                            false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                uint32_t pid = w * 64 + bit;
+                __atomic_store_n(&next_pid, pid + 1 < MAX_PIDS ? pid + 1 : 1, __ATOMIC_RELAXED);
+                return pid;
+            }
         }
-        next_pid = (next_pid + 1 >= MAX_PIDS) ? 1 : next_pid + 1;
-        if (!pid_table[i]) { found = i; break; }
-    }
-    if (!found) {
-        serial_printf("[PID] FATAL: pid table exhausted (MAX_PIDS=%u)!\n", MAX_PIDS);
     }
-    spinlock_release_irqrestore(&pid_lock, _irqf);
-    return found;
+    serial_printf("[PID] FATAL: pid table exhausted (MAX_PIDS=%u)!\n", MAX_PIDS);
+    return 0;
+}
+
+static void pid_release(uint32_t pid) {
+    if (pid == 0 || pid >= MAX_PIDS) return;
+    __atomic_fetch_and(&pid_bitmap[pid / 64], ~(1ULL << (pid % 64)), __ATOMIC_RELEASE);
 }
 
 task_t* task_find_by_pid(uint32_t pid) {
     if (pid == 0 || pid >= MAX_PIDS) return NULL;
-    return pid_table[pid];
+    return __atomic_load_n(&pid_table[pid], __ATOMIC_ACQUIRE);
 }
 
 static void pid_register(task_t* t) {
-    if (t->pid && t->pid < MAX_PIDS) pid_table[t->pid] = t;
+    if (t->pid && t->pid < MAX_PIDS)
+        __atomic_store_n(&pid_table[t->pid], t, __ATOMIC_RELEASE);
 }
 
 static void pid_unregister(task_t* t) {
-    if (t->pid && t->pid < MAX_PIDS) pid_table[t->pid] = NULL;
+    if (!t->pid || t->pid >= MAX_PIDS) return;
+    task_t* expected = t;
+    __atomic_compare_exchange_n(&pid_table[t->pid], &expected, NULL,
+                                false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+    pid_release(t->pid);
 }
 
 static void idle_loop(void* arg);
 
 #define STACK_CANARY_VALUE  0xDEADC0DEDEADC0DEULL
 
-static uint64_t alloc_and_init_stack(task_t* t) {
-    uintptr_t stack_virt = (uintptr_t)pmm_alloc_zero(KERNEL_STACK_PAGES);
-    if (!stack_virt) return 0;
-    t->stack_base = stack_virt;
+static kmem_cache_t* task_cache;
+static kmem_cache_t* fpu_cache;
+static volatile uint64_t kstack_reused = 0;
+
+static inline task_t* task_alloc(void) {
+    return kmem_cache_zalloc(task_cache);
+}
 
-    uint64_t* canary_page = (uint64_t*)stack_virt;
+static inline void task_free(task_t* t) {
+    kmem_cache_free(task_cache, t);
+}
+
+static inline void rcu_note_qs(percpu_t* pc) {
+    __atomic_store_n(&pc->rcu_qs, __atomic_load_n(&rcu_gp_seq, __ATOMIC_ACQUIRE),
+                     __ATOMIC_RELEASE);
+}
+
+static uint64_t rcu_completed(void) {
+    uint64_t done = __atomic_load_n(&rcu_gp_seq, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < smp_get_cpu_count(); i++) {
+        percpu_t* pc = percpu_regions[i];
+        if (!pc || __atomic_load_n(&pc->rcu_nohz, __ATOMIC_SEQ_CST)) continue;
+        uint64_t qs = __atomic_load_n(&pc->rcu_qs, __ATOMIC_ACQUIRE);
+        if (qs < done) done = qs;
+    }
+    return done;
+}
+
+static void task_retire(task_t* t) {
+    t->rcu_next = NULL;
+    uint64_t f = spinlock_acquire_irqsave(&retire_lock);
+    t->rcu_seq = __atomic_add_fetch(&rcu_gp_seq, 1, __ATOMIC_SEQ_CST);
+    if (retire_tail) retire_tail->rcu_next = t;
+    else             retire_head = t;
+    retire_tail = t;
+    percpu_t* pc = get_percpu();
+    if (pc) rcu_note_qs(pc);
+    spinlock_release_irqrestore(&retire_lock, f);
+}
+
+void sched_quiescent(void) {
+    percpu_t* pc = get_percpu();
+    if (!pc) return;
+    rcu_note_qs(pc);
+    if (!__atomic_load_n(&retire_head, __ATOMIC_RELAXED)) return;
+    if (!spinlock_try_acquire(&retire_lock)) return;
+    uint64_t done = rcu_completed();
+    task_t* batch = NULL;
+    while (retire_head && retire_head->rcu_seq <= done) {
+        task_t* t = retire_head;
+        retire_head = t->rcu_next;
+        t->rcu_next = batch;
+        batch = t;
+    }
+    if (!retire_head) retire_tail = NULL;
+    spinlock_release(&retire_lock);
+    while (batch) {
+        task_t* nx = batch->rcu_next;
+        task_free(batch);
+        batch = nx;
+    }
+}
+
+static fpu_state_t* fpu_area_alloc(void) {
+    fpu_state_t* area = kmem_cache_zalloc(fpu_cache);
+    if (area) fpu_state_init(area);
+    return area;
+}
+
+static bool stack_canary_intact(uintptr_t base) {
+    const uint64_t* canary_page = (const uint64_t*)base;
     for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++)
-        canary_page[i] = STACK_CANARY_VALUE;
+        if (canary_page[i] != STACK_CANARY_VALUE) return false;
+    return true;
+}
+
+static uintptr_t kstack_pool_get(void) {
+    uintptr_t base = 0;
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+    percpu_t* pc = get_percpu();
+    if (pc && pc->kstack_pool_count)
+        base = pc->kstack_pool[--pc->kstack_pool_count];
+    asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
+    return base;
+}
+
+static void kstack_release(task_t* t) {
+    uintptr_t base = t->stack_base;
+    if (!stack_canary_intact(base)) {
+        serial_printf("[SCHED] pid=%u kernel stack canary clobbered (base=0x%llx)\n",
+                      t->pid, base);
+        pmm_free((void*)base, KERNEL_STACK_PAGES);
+        return;
+    }
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+    percpu_t* pc = get_percpu();
+    if (pc && pc->kstack_pool_count < KSTACK_POOL_PER_CPU) {
+        pc->kstack_pool[pc->kstack_pool_count++] = base;
+        base = 0;
+    }
+    asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
+    if (base) pmm_free((void*)base, KERNEL_STACK_PAGES);
+}
+
+static uint64_t alloc_and_init_stack(task_t* t) {
+    uintptr_t stack_virt = kstack_pool_get();
+    if (stack_virt) {
+        __atomic_fetch_add(&kstack_reused, 1, __ATOMIC_RELAXED);
+    } else {
+        stack_virt = (uintptr_t)pmm_alloc(KERNEL_STACK_PAGES);
+        if (!stack_virt) return 0;
+        uint64_t* canary_page = (uint64_t*)stack_virt;
+        for (size_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++)
+            canary_page[i] = STACK_CANARY_VALUE;
+    }
+    t->stack_base = stack_virt;
 
     uintptr_t stack_top = (stack_virt + KERNEL_STACK_SIZE) & ~0xFULL;
     uint64_t* sp = (uint64_t*)stack_top;
@@ -109,11 +270,366 @@ static uint64_t alloc_and_init_stack(task_t* t) {
     return (uint64_t)sp;
 }
 
-static void enqueue_global(task_t* t) {
-    uint64_t f = spinlock_acquire_irqsave(&ready_queue_lock);
-    t->next = ready_queues[t->priority];
-    ready_queues[t->priority] = t;
-    spinlock_release_irqrestore(&ready_queue_lock, f);
+static runqueue_t* this_rq(void) {
+    percpu_t* pc = get_percpu();
+    if (pc) return &pc->rq;
+    if (percpu_regions[0]) return &percpu_regions[0]->rq;
+    kernel_panic("SCHED: no per-CPU run queue");
+}
+
+static inline bool task_queueable(task_t* t) {
+    return t->runnable && t->state != TASK_ZOMBIE && t->state != TASK_DEAD;
+}
+
+static inline bool rq_claim(task_t* t) {
+    bool expected = false;
+    return atomic_cas_bool(&t->on_rq, &expected, true);
+}
+
+static inline bool task_allowed_on(const task_t* t, uint32_t cpu) {
+    if (!t->cpu_affinity) return true;
+    return cpu < 64 && (t->cpu_affinity & (1ULL << cpu));
+}
+
+/* Each RT task is charged to one run queue it may run on, chosen as the
+ * least loaded in its affinity set, so pinning RT work onto a CPU cannot
+ * borrow headroom from CPUs it will never use. */
+static bool rt_admit(task_t* t) {
+    for (;;) {
+        uint32_t best = UINT32_MAX, n = SCHED_RT_MAX_PER_CPU;
+        for (uint32_t i = 0; i < smp_get_cpu_count(); i++) {
+            if (!percpu_regions[i] || !task_allowed_on(t, i)) continue;
+            uint32_t c = __atomic_load_n(&percpu_regions[i]->rq.nr_rt_admitted, __ATOMIC_RELAXED);
+            if (c < n) { best = i; n = c; }
+        }
+        if (best == UINT32_MAX) return false;
+        if (__atomic_compare_exchange_n(&percpu_regions[best]->rq.nr_rt_admitted, &n, n + 1,
+                                        false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            t->rt_cpu = (uint16_t)best;
+            return true;
+        }
+    }
+}
+
+static void rt_release(task_t* t) {
+    if (sched_class_is_rt(t->sched_class))
+        __atomic_fetch_sub(&percpu_regions[t->rt_cpu]->rq.nr_rt_admitted, 1, __ATOMIC_RELAXED);
+}
+
+static uint32_t rt_admitted_total(void) {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < smp_get_cpu_count(); i++)
+        if (percpu_regions[i])
+            n += __atomic_load_n(&percpu_regions[i]->rq.nr_rt_admitted, __ATOMIC_RELAXED);
+    return n;
+}
+
+static inline int rq_highest(uint32_t map) {
+    uint32_t idx;
+    asm("bsr %1, %0" : "=r"(idx) : "rm"(map) : "cc");
+    return (int)idx;
+}
+
+static void rq_list_append(rq_list_t* q, task_t* t) {
+    t->next = NULL;
+    t->prev = q->tail;
+    if (q->tail) q->tail->next = t;
+    else         q->head       = t;
+    q->tail = t;
+}
+
+static void rq_list_del(rq_list_t* q, task_t* t) {
+    if (t->prev) t->prev->next = t->next;
+    else         q->head       = t->next;
+    if (t->next) t->next->prev = t->prev;
+    else         q->tail       = t->prev;
+    t->next = t->prev = NULL;
+}
+
+static const uint32_t fair_weight[MAX_PRIORITY + 1] = {
+       29,    36,    45,    56,    70,    87,   110,   137,
+      172,   215,   272,   335,   423,   526,   655,   820,
+     1024,  1277,  1586,  1991,  2501,  3121,  3906,  4904,
+     6100,  7620,  9548, 11916, 14949, 18705, 23254, 29154,
+};
+
+static inline uint64_t sched_clock_ns(void) {
+    return sched_trace_tsc_to_ns(sched_rdtsc());
+}
+
+static void update_curr(task_t* t, uint64_t now) {
+    if (!t->exec_start || now <= t->exec_start) {
+        t->exec_start = now;
+        return;
+    }
+    uint64_t delta = now - t->exec_start;
+    t->exec_start     = now;
+    t->total_runtime += delta;
+    if (t->sched_class == SCHED_CLASS_FAIR)
+        t->vruntime += delta * fair_weight[DEFAULT_PRIORITY] / fair_weight[t->priority];
+}
+
+static void rq_fair_insert(runqueue_t* rq, task_t* t) {
+    uint64_t floor = rq->min_vruntime > SCHED_FAIR_LATENCY_NS / 2
+                   ? rq->min_vruntime - SCHED_FAIR_LATENCY_NS / 2 : 0;
+    if (t->vruntime < floor) t->vruntime = floor;
+
+    task_t* after = rq->fair.tail;
+    while (after && after->vruntime > t->vruntime) after = after->prev;
+
+    t->prev = after;
+    t->next = after ? after->next : rq->fair.head;
+    if (t->next) t->next->prev = t;
+    else         rq->fair.tail = t;
+    if (after)   after->next   = t;
+    else         rq->fair.head = t;
+}
+
+static void rq_push(runqueue_t* rq, task_t* t) {
+    if (sched_class_is_rt(t->sched_class)) {
+        t->rq_level = (int8_t)t->priority;
+        rq_list_append(&rq->queues[t->priority], t);
+        rq->bitmap |= 1U << t->priority;
+    } else {
+        t->rq_level = -1;
+        rq_fair_insert(rq, t);
+        rq->nr_fair++;
+    }
+    t->rq = rq;
+    rq->nr_running++;
+    if (!t->queued_tsc) t->queued_tsc = sched_rdtsc();
+}
+
+static void rq_unlink(runqueue_t* rq, task_t* t) {
+    if (t->rq_level < 0) {
+        rq_list_del(&rq->fair, t);
+        rq->nr_fair--;
+    } else {
+        rq_list_t* q = &rq->queues[t->rq_level];
+        rq_list_del(q, t);
+        if (!q->head)
+            rq->bitmap &= ~(1U << t->rq_level);
+    }
+    t->rq = NULL;
+    rq->nr_running--;
+}
+
+static void rq_remove_task(task_t* t) {
+    for (;;) {
+        runqueue_t* rq = __atomic_load_n(&t->rq, __ATOMIC_ACQUIRE);
+        if (!rq) {
+            /* Claimed by an enqueuer or a stealer that has not pushed yet;
+             * both hold IRQs off across that window, so it is short. */
+            if (!atomic_load_bool_acq(&t->on_rq)) return;
+            asm volatile("pause");
+            continue;
+        }
+        uint64_t f = spinlock_acquire_irqsave(&rq->lock);
+        if (t->rq == rq) {
+            rq_unlink(rq, t);
+            t->queued_tsc = 0;
+            atomic_store_bool_rel(&t->on_rq, false);
+            spinlock_release_irqrestore(&rq->lock, f);
+            return;
+        }
+        spinlock_release_irqrestore(&rq->lock, f);
+    }
+}
+
+static void task_dequeue(task_t* t) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (atomic_load_bool_acq(&t->on_rq))
+        rq_remove_task(t);
+}
+
+extern uint32_t smp_get_lapic_id_for_cpu(uint32_t);
+
+static uint64_t nohz_idle_mask[MAX_CPUS / 64];
+
+static void nohz_kick_one(uint32_t self) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (uint32_t w = 0; w < MAX_CPUS / 64; w++) {
+        uint64_t mask = __atomic_load_n(&nohz_idle_mask[w], __ATOMIC_RELAXED);
+        if (self / 64 == w) mask &= ~(1ULL << (self % 64));
+        while (mask) {
+            uint64_t bit = mask & -mask;
+            mask &= ~bit;
+            if (__atomic_fetch_and(&nohz_idle_mask[w], ~bit, __ATOMIC_ACQ_REL) & bit) {
+                uint32_t cpu = w * 64 + (uint32_t)__builtin_ctzll(bit);
+                ipi_reschedule_single(smp_get_lapic_id_for_cpu(cpu));
+                return;
+            }
+        }
+    }
+}
+
+static bool nohz_kick_cpu(uint32_t cpu) {
+    uint64_t bit = 1ULL << (cpu % 64);
+    if (!(__atomic_fetch_and(&nohz_idle_mask[cpu / 64], ~bit, __ATOMIC_ACQ_REL) & bit))
+        return false;
+    ipi_reschedule_single(smp_get_lapic_id_for_cpu(cpu));
+    return true;
+}
+
+static inline uint32_t rq_load(uint32_t cpu) {
+    percpu_t* pc = percpu_regions[cpu];
+    return pc ? __atomic_load_n(&pc->rq.nr_running, __ATOMIC_RELAXED) : UINT32_MAX;
+}
+
+static inline bool rt_preempts(const task_t* t, const task_t* cur, uint32_t cpu) {
+    if (!cur || cur == &idle_tasks[cpu]) return true;
+    if (cur == t) return false;
+    if (!sched_class_is_rt(cur->sched_class)) return true;
+    return t->priority > cur->priority;
+}
+
+static uint32_t select_rt_cpu(const task_t* t, uint32_t self) {
+    uint32_t ncpu = smp_get_cpu_count();
+    if (t->last_cpu < ncpu && percpu_regions[t->last_cpu] && task_allowed_on(t, t->last_cpu) &&
+        rt_preempts(t, current_task[t->last_cpu], t->last_cpu))
+        return t->last_cpu;
+    if (percpu_regions[self] && task_allowed_on(t, self) && rt_preempts(t, current_task[self], self))
+        return self;
+    for (uint32_t i = 0; i < ncpu; i++) {
+        if (!percpu_regions[i] || !task_allowed_on(t, i)) continue;
+        if (rt_preempts(t, current_task[i], i)) return i;
+    }
+    return UINT32_MAX;
+}
+
+static uint32_t select_task_cpu(const task_t* t, uint32_t self) {
+    uint32_t ncpu = smp_get_cpu_count();
+    uint32_t local_load = rq_load(self);
+
+    if (sched_class_is_rt(t->sched_class)) {
+        uint32_t cpu = select_rt_cpu(t, self);
+        if (cpu != UINT32_MAX) return cpu;
+    }
+
+    if ((t->flags & TASK_FLAG_STARTED) && t->last_cpu < ncpu &&
+        percpu_regions[t->last_cpu] && task_allowed_on(t, t->last_cpu) &&
+        rq_load(t->last_cpu) <= local_load + 1)
+        return t->last_cpu;
+
+    if (task_allowed_on(t, self) && percpu_regions[self])
+        return self;
+
+    uint32_t best = self, best_load = UINT32_MAX;
+    for (uint32_t i = 0; i < ncpu; i++) {
+        if (!percpu_regions[i] || !task_allowed_on(t, i)) continue;
+        uint32_t load = rq_load(i);
+        if (load < best_load) { best = i; best_load = load; }
+    }
+    return best;
+}
+
+static void enqueue_task(task_t* t) {
+    uint64_t irqf;
+    asm volatile("pushfq; pop %0; cli" : "=r"(irqf) :: "memory");
+    if (!rq_claim(t)) {
+        asm volatile("push %0; popfq" :: "r"(irqf) : "memory", "cc");
+        return;
+    }
+    uint32_t self = this_cpu_id();
+    uint32_t cpu  = percpu_regions[self] ? select_task_cpu(t, self) : self;
+    runqueue_t* rq = (cpu != self && percpu_regions[cpu]) ? &percpu_regions[cpu]->rq : this_rq();
+    bool rt = sched_class_is_rt(t->sched_class);
+    if (rt) t->wake_stamp = sched_clock_ns();
+    if ((t->flags & TASK_FLAG_STARTED) && t->last_cpu != cpu) {
+        t->nr_migrations++;
+        sched_trace_event(SCHED_EV_MIGRATE, t->pid, t->last_cpu, cpu);
+    }
+    spinlock_acquire(&rq->lock);
+    if (!task_queueable(t)) {
+        /* Blocked or exited after the waker set runnable; task_dequeue on
+         * that side saw on_rq set and is waiting for us to let go. */
+        atomic_store_bool_rel(&t->on_rq, false);
+        spinlock_release(&rq->lock);
+        asm volatile("push %0; popfq" :: "r"(irqf) : "memory", "cc");
+        return;
+    }
+    sched_trace_event(SCHED_EV_WAKEUP, t->pid, cpu, 0);
+    rq_push(rq, t);
+    spinlock_release(&rq->lock);
+    asm volatile("push %0; popfq" :: "r"(irqf) : "memory", "cc");
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (rt && rt_preempts(t, current_task[cpu], cpu)) {
+        if (cpu == self) {
+            this_cpu()->need_resched = true;
+        } else if (!nohz_kick_cpu(cpu)) {
+            ipi_reschedule_cpu(smp_get_lapic_id_for_cpu(cpu));
+        }
+        return;
+    }
+    if (cpu == self || !nohz_kick_cpu(cpu))
+        nohz_kick_one(self);
+}
+
+static task_t*    sleep_heap[MAX_PIDS];
+static uint32_t   sleep_count = 0;
+static spinlock_t sleep_lock  = SPINLOCK_INIT;
+
+static void sleep_heap_set(uint32_t i, task_t* t) {
+    sleep_heap[i] = t;
+    t->sleep_slot = i + 1;
+}
+
+static void sleep_heap_up(uint32_t i) {
+    task_t* t = sleep_heap[i];
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (sleep_heap[parent]->wakeup_time_ns <= t->wakeup_time_ns) break;
+        sleep_heap_set(i, sleep_heap[parent]);
+        i = parent;
+    }
+    sleep_heap_set(i, t);
+}
+
+static void sleep_heap_down(uint32_t i) {
+    task_t* t = sleep_heap[i];
+    for (;;) {
+        uint32_t c = 2 * i + 1;
+        if (c >= sleep_count) break;
+        if (c + 1 < sleep_count &&
+            sleep_heap[c + 1]->wakeup_time_ns < sleep_heap[c]->wakeup_time_ns)
+            c++;
+        if (t->wakeup_time_ns <= sleep_heap[c]->wakeup_time_ns) break;
+        sleep_heap_set(i, sleep_heap[c]);
+        i = c;
+    }
+    sleep_heap_set(i, t);
+}
+
+static void sleep_heap_remove(task_t* t) {
+    uint32_t i = t->sleep_slot - 1;
+    t->sleep_slot = 0;
+    if (--sleep_count == i) return;
+    task_t* last = sleep_heap[sleep_count];
+    sleep_heap_set(i, last);
+    sleep_heap_down(i);
+    sleep_heap_up(last->sleep_slot - 1);
+}
+
+void sched_sleep_until(task_t* t, uint64_t deadline_ns) {
+    uint64_t f = spinlock_acquire_irqsave(&sleep_lock);
+    if (t->sleep_slot) sleep_heap_remove(t);
+    t->wakeup_time_ns = deadline_ns ? deadline_ns : 1;
+    sleep_heap[sleep_count] = t;
+    sleep_heap_up(sleep_count++);
+    bool earliest = sleep_heap[0] == t;
+    spinlock_release_irqrestore(&sleep_lock, f);
+
+    if (earliest &&
+        (__atomic_fetch_and(&nohz_idle_mask[0], ~1ULL, __ATOMIC_ACQ_REL) & 1ULL))
+        ipi_reschedule_single(smp_get_lapic_id_for_cpu(0));
+}
+
+void sched_sleep_cancel(task_t* t) {
+    uint64_t f = spinlock_acquire_irqsave(&sleep_lock);
+    if (t->sleep_slot) sleep_heap_remove(t);
+    t->wakeup_time_ns = 0;
+    spinlock_release_irqrestore(&sleep_lock, f);
 }
 
 void __attribute__((used)) ctx_rsp_corruption_detected(task_t* old, uint64_t saved_rsp) {
@@ -125,19 +641,79 @@ void __attribute__((used)) ctx_rsp_corruption_detected(task_t* old, uint64_t sav
     kernel_panic("context_switch: saved invalid RSP into task->rsp");
 }
 
+static void task_teardown(task_t* task) {
+    if (!task->parent && (!task->ppid || (task->flags & TASK_FLAG_THREAD)))
+        task_destroy(task);
+
+    if (task->fpu_state) {
+        kmem_cache_free(fpu_cache, task->fpu_state);
+        task->fpu_state = NULL;
+    }
+
+    if (task->stack_base) {
+        kstack_release(task);
+        task->stack_base = 0;
+    }
+
+    if (task->pagemap && (task->flags & (TASK_FLAG_FORK | TASK_FLAG_OWN_PAGEMAP))) {
+        vmm_pagemap_put(task->pagemap);
+        task->pagemap = NULL;
+    }
+
+    if (task->fd_table) {
+        fd_table_destroy(task->fd_table);
+        task->fd_table = NULL;
+    }
+
+    uint32_t old = __atomic_fetch_or(&task->flags, TASK_FLAG_TORNDOWN, __ATOMIC_ACQ_REL);
+    if (old & TASK_FLAG_REAPED) task_retire(task);
+}
+
+static void reclaim_push(percpu_t* pc, task_t* t) {
+    task_t* head = __atomic_load_n(&pc->reclaim_head, __ATOMIC_RELAXED);
+    do {
+        t->reclaim_next = head;
+    } while (!__atomic_compare_exchange_n(&pc->reclaim_head, &head, t, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    __atomic_fetch_add(&pc->reclaim_count, 1, __ATOMIC_RELAXED);
+}
+
+void sched_reclaim(void) {
+    percpu_t* pc = get_percpu();
+    if (!pc || !__atomic_load_n(&pc->reclaim_head, __ATOMIC_RELAXED)) return;
+    task_t* batch = __atomic_exchange_n(&pc->reclaim_head, NULL, __ATOMIC_ACQUIRE);
+    uint32_t n = 0;
+    while (batch) {
+        task_t* nx = batch->reclaim_next;
+        task_teardown(batch);
+        batch = nx;
+        n++;
+    }
+    __atomic_fetch_sub(&pc->reclaim_count, n, __ATOMIC_RELAXED);
+}
+
 static void process_deferred_free(void) {
     percpu_t* pc = get_percpu();
     if (!pc) return;
     task_t* dead = (task_t*)pc->deferred_free_task;
-    if (!dead) return;
-    pc->deferred_free_task = NULL;
-    task_destroy(dead);
+    if (dead) {
+        pc->deferred_free_task = NULL;
+        reclaim_push(pc, dead);
+    }
+    if (__atomic_load_n(&pc->reclaim_count, __ATOMIC_RELAXED) >= SCHED_RECLAIM_BATCH)
+        sched_reclaim();
 }
 
 void sched_init(void) {
     memset(pid_table, 0, sizeof(pid_table));
+    memset(pid_bitmap, 0, sizeof(pid_bitmap));
+    pid_bitmap[0] = 1;
     memset(bootstrap_tasks, 0, sizeof(bootstrap_tasks));
     next_pid = 1;
+    task_cache = kmem_cache_create("task", sizeof(task_t), 64, NULL);
+    fpu_cache  = kmem_cache_create("fpu_state", fpu_state_size, 64, NULL);
+    if (!task_cache || !fpu_cache)
+        kernel_panic("SCHED: failed to create task caches");
     for (uint32_t i = 0; i < smp_get_cpu_count(); i++) {
         task_t* idle = &idle_tasks[i];
         memset(idle, 0, sizeof(task_t));
@@ -156,6 +732,7 @@ void sched_init(void) {
         idle->gid             = GID_ROOT;
         idle->capabilities    = CAP_ALL;
         atomic_init_bool(&idle->on_cpu, false);
+        atomic_init_bool(&idle->on_rq, false);
         idle->name[0]='i'; idle->name[1]='d';
         idle->name[2]='l'; idle->name[3]='e';
         idle->rsp = alloc_and_init_stack(idle);
@@ -164,14 +741,15 @@ void sched_init(void) {
         }
         current_task[i] = NULL;
     }
+    sched_trace_init();
     serial_writestring("Scheduler initialized (PREEMPTIVE SMP MODE)\n");
 }
 
 task_t* task_create(const char* name, void (*entry)(void*), void* arg, int priority) {
-    task_t* t = calloc(1, sizeof(task_t));
+    task_t* t = task_alloc();
     if (!t) return NULL;
     t->pid             = task_alloc_pid();
-    if (!t->pid) { free(t); return NULL; }
+    if (!t->pid) { task_free(t); return NULL; }
     t->ppid            = 0;
     t->uid             = UID_ROOT;
     t->gid             = GID_ROOT;
@@ -187,21 +765,22 @@ task_t* task_create(const char* name, void (*entry)(void*), void* arg, int prior
     t->rip             = (uint64_t)entry;
     t->is_userspace    = TASK_TYPE_KERNEL;
     atomic_init_bool(&t->on_cpu, false);
+    atomic_init_bool(&t->on_rq, false);
     strncpy(t->name, name, sizeof(t->name) - 1);
     t->rsp = alloc_and_init_stack(t);
-    if (!t->rsp) { free(t); return NULL; }
-    t->fpu_state = (fpu_state_t*)pmm_alloc_zero(1);
+    if (!t->rsp) { pid_release(t->pid); task_free(t); return NULL; }
+    t->fpu_state = fpu_area_alloc();
     pid_register(t);
-    enqueue_global(t);
+    enqueue_task(t);
     serial_printf("[SCHED] task_create: '%s' pid=%u prio=%d\n", t->name, t->pid, t->priority);
     return t;
 }
 
 task_t* task_create_user(const char* name, uintptr_t entry, uintptr_t user_rsp, uint64_t cr3, int priority, vmm_pagemap_t* pagemap, uint32_t uid, uint32_t gid) {
-    task_t* t = calloc(1, sizeof(task_t));
+    task_t* t = task_alloc();
     if (!t) return NULL;
     t->pid             = task_alloc_pid();
-    if (!t->pid) { free(t); return NULL; }
+    if (!t->pid) { task_free(t); return NULL; }
     t->ppid            = 0;
     t->uid             = uid;
     t->gid             = gid;
@@ -219,14 +798,12 @@ task_t* task_create_user(const char* name, uintptr_t entry, uintptr_t user_rsp,
     t->user_rsp        = user_rsp;
     t->cr3             = cr3;
     t->pagemap         = pagemap;
-    t->brk_start       = 0;
-    t->brk_current     = 0;
-    t->brk_max         = 0x0000700000000000ULL;
     atomic_init_bool(&t->on_cpu, false);
+    atomic_init_bool(&t->on_rq, false);
     strncpy(t->name, name, sizeof(t->name) - 1);
     t->rsp = alloc_and_init_stack(t);
-    if (!t->rsp) { free(t); return NULL; }
-    t->fpu_state = (fpu_state_t*)pmm_alloc_zero(1);
+    if (!t->rsp) { pid_release(t->pid); task_free(t); return NULL; }
+    t->fpu_state = fpu_area_alloc();
 
     t->fd_table = fd_table_create();
     if (t->fd_table) {
@@ -239,18 +816,18 @@ task_t* task_create_user(const char* name, uintptr_t entry, uintptr_t user_rsp,
     t->flags |= TASK_FLAG_OWN_PAGEMAP;
 
     pid_register(t);
-    enqueue_global(t);
+    enqueue_task(t);
     serial_printf("[SCHED] task_create_user: '%s' pid=%u uid=%u entry=0x%llx user_rsp=0x%llx caps=0x%llx\n",
                   t->name, t->pid, t->uid, entry, user_rsp, t->capabilities);
     return t;
 }
 
-task_t* task_fork(task_t* parent) {
+task_t* task_clone(task_t* parent, uint64_t flags, uintptr_t user_stack, uint64_t tls) {
     if (!parent) return NULL;
-    task_t* child = calloc(1, sizeof(task_t));
+    task_t* child = task_alloc();
     if (!child) return NULL;
     child->pid = task_alloc_pid();
-    if (!child->pid) { free(child); return NULL; }
+    if (!child->pid) { task_free(child); return NULL; }
     child->ppid            = parent->pid;
     child->priority        = parent->priority;
     child->is_userspace    = parent->is_userspace;
@@ -260,13 +837,20 @@ task_t* task_fork(task_t* parent) {
     child->capabilities    = parent->capabilities;
     child->time_slice      = parent->time_slice_init;
     child->time_slice_init = parent->time_slice_init;
-    child->pagemap = vmm_clone_pagemap(parent->pagemap);
-    if (!child->pagemap) { free(child); return NULL; }
+    child->cpu_affinity    = parent->cpu_affinity;
+    child->vruntime        = parent->vruntime;
+    if (sched_class_is_rt(parent->sched_class) && rt_admit(child))
+        child->sched_class = parent->sched_class;
+    if (flags & CLONE_VM) {
+        vmm_pagemap_get(parent->pagemap);
+        child->pagemap = parent->pagemap;
+    } else {
+        child->pagemap = vmm_clone_pagemap(parent->pagemap);
+        if (!child->pagemap) { rt_release(child); pid_release(child->pid); task_free(child); return NULL; }
+    }
     child->cr3 = (uint64_t)pmm_virt_to_phys(child->pagemap->pml4);
-    child->brk_start   = parent->brk_start;
-    child->brk_current = parent->brk_current;
-    child->brk_max     = parent->brk_max;
-    child->user_rsp = parent->user_rsp;
+    child->user_rsp = user_stack ? user_stack : parent->user_rsp;
+    child->fs_base  = (flags & CLONE_SETTLS) ? tls : parent->fs_base;
     serial_printf("[FORK-DBG2] parent pid=%u user_rsp=0x%llx user_saved_rip=0x%llx\n",
                   parent->pid, parent->user_rsp, parent->user_saved_rip);
 
@@ -280,30 +864,37 @@ task_t* task_fork(task_t* parent) {
     child->user_saved_r11 = parent->user_saved_r11 | (1ULL << 9);
 
     child->flags |= TASK_FLAG_FORK;
+    if (flags & CLONE_VFORK) child->flags |= TASK_FLAG_VFORK;
     atomic_init_bool(&child->on_cpu, false);
+    atomic_init_bool(&child->on_rq, false);
     child->rsp = alloc_and_init_stack(child);
     if (!child->rsp) {
-        vmm_free_pagemap(child->pagemap);
-        free(child);
+        rt_release(child);
+        vmm_pagemap_put(child->pagemap);
+        pid_release(child->pid);
+        task_free(child);
         return NULL;
     }
     vmm_sync_kernel_mappings(child->pagemap);
     serial_printf("[FORK-DBG] child pid=%u stack_base=0x%llx rsp=0x%llx\n",
                   child->pid, child->stack_base, child->rsp);
-    child->fpu_state = (fpu_state_t*)pmm_alloc_zero(1);
+    child->fpu_state = fpu_area_alloc();
     if (child->fpu_state && parent->fpu_state) {
-        memcpy(child->fpu_state, parent->fpu_state, sizeof(fpu_state_t));
+        memcpy(child->fpu_state, parent->fpu_state, fpu_state_size);
         child->fpu_used = parent->fpu_used;
     }
 
     if (parent->fd_table)
-        child->fd_table = fd_table_clone(parent->fd_table);
+        child->fd_table = (flags & CLONE_FILES) ? fd_table_get(parent->fd_table)
+                                                : fd_table_clone(parent->fd_table);
 
     child->state    = TASK_READY;
     child->runnable = true;
-    child->parent   = parent;
 
-    {
+    if (flags & CLONE_THREAD) {
+        child->flags |= TASK_FLAG_THREAD;
+    } else {
+        child->parent = parent;
         uint64_t _cf = spinlock_acquire_irqsave(&children_lock);
         child->sibling   = parent->children;
         parent->children = child;
@@ -315,13 +906,85 @@ task_t* task_fork(task_t* parent) {
     serial_printf("[FORK-CHK] child=%p rsp=0x%llx stk=0x%llx rip=0x%llx\n",
                   (void*)child, child->rsp, child->stack_base, child->user_saved_rip);
 
-    serial_printf("[SCHED] fork: parent='%s' pid=%u -> child pid=%u rip=0x%llx\n",
+    serial_printf("[SCHED] %s: parent='%s' pid=%u -> child pid=%u rip=0x%llx\n",
+                  (flags & CLONE_VM) ? "clone" : "fork",
                   parent->name, parent->pid, child->pid, child->user_saved_rip);
 
-    enqueue_global(child);
+    enqueue_task(child);
     return child;
 }
 
+task_t* task_fork(task_t* parent) {
+    return task_clone(parent, 0, 0, 0);
+}
+
+task_t* task_spawn(task_t* parent, const char* name, uintptr_t entry, uintptr_t user_rsp,
+                   vmm_pagemap_t* pagemap, fd_table_t* fd_table) {
+    if (!parent || !pagemap) return NULL;
+    task_t* t = task_alloc();
+    if (!t) return NULL;
+    t->pid = task_alloc_pid();
+    if (!t->pid) { task_free(t); return NULL; }
+    t->ppid            = parent->pid;
+    t->uid             = parent->uid;
+    t->gid             = parent->gid;
+    t->capabilities    = parent->capabilities;
+    t->priority        = parent->priority;
+    t->time_slice      = parent->time_slice_init;
+    t->time_slice_init = parent->time_slice_init;
+    t->cpu_affinity    = parent->cpu_affinity;
+    t->vruntime        = parent->vruntime;
+    if (sched_class_is_rt(parent->sched_class) && rt_admit(t))
+        t->sched_class = parent->sched_class;
+    t->entry           = (void (*)(void*))entry;
+    t->rip             = entry;
+    t->cpu_id          = (uint32_t)-1;
+    t->is_userspace    = TASK_TYPE_USER;
+    t->user_rsp        = user_rsp;
+    t->pagemap         = pagemap;
+    t->cr3             = (uint64_t)pmm_virt_to_phys(pagemap->pml4);
+    t->flags          |= TASK_FLAG_OWN_PAGEMAP;
+    atomic_init_bool(&t->on_cpu, false);
+    atomic_init_bool(&t->on_rq, false);
+    strncpy(t->name, name, sizeof(t->name) - 1);
+    t->rsp = alloc_and_init_stack(t);
+    if (!t->rsp) { rt_release(t); pid_release(t->pid); task_free(t); return NULL; }
+    t->fpu_state = fpu_area_alloc();
+    t->fd_table  = fd_table;
+
+    t->state    = TASK_READY;
+    t->runnable = true;
+
+    t->parent = parent;
+    uint64_t _cf = spinlock_acquire_irqsave(&children_lock);
+    t->sibling       = parent->children;
+    parent->children = t;
+    spinlock_release_irqrestore(&children_lock, _cf);
+
+    pid_register(t);
+    enqueue_task(t);
+    serial_printf("[SCHED] task_spawn: parent pid=%u -> '%s' pid=%u entry=0x%llx user_rsp=0x%llx\n",
+                  parent->pid, t->name, t->pid, entry, user_rsp);
+    return t;
+}
+
+void task_vfork_wait(task_t* parent, task_t* child) {
+    wait_entry_t wait = {0};
+    for (;;) {
+        wait_prepare(&parent->child_wq, &wait);
+        if (!(__atomic_load_n(&child->flags, __ATOMIC_ACQUIRE) & TASK_FLAG_VFORK) ||
+            parent->pending_kill)
+            break;
+        wait_sleep(&wait);
+    }
+    wait_finish(&parent->child_wq, &wait);
+}
+
+void task_vfork_done(task_t* child) {
+    uint32_t old = __atomic_fetch_and(&child->flags, ~TASK_FLAG_VFORK, __ATOMIC_ACQ_REL);
+    if (old & TASK_FLAG_VFORK) task_wakeup_waiters(child);
+}
+
 void task_destroy(task_t* task) {
     if (!task) return;
 
@@ -333,27 +996,14 @@ void task_destroy(task_t* task) {
 
     pid_unregister(task);
 
-    if (task->fpu_state) {
-        pmm_free(task->fpu_state, 1);
-        task->fpu_state = NULL;
-    }
+    if (atomic_load_bool_acq(&task->on_rq))
+        rq_remove_task(task);
+    if (task->sleep_slot)
+        sched_sleep_cancel(task);
+    rt_release(task);
 
-    if (task->stack_base) {
-        pmm_free((void*)task->stack_base, KERNEL_STACK_PAGES);
-        task->stack_base = 0;
-    }
-
-    if (task->pagemap && (task->flags & (TASK_FLAG_FORK | TASK_FLAG_OWN_PAGEMAP))) {
-        vmm_free_pagemap(task->pagemap);
-        task->pagemap = NULL;
-    }
-
-    if (task->fd_table) {
-        fd_table_destroy(task->fd_table);
-        task->fd_table = NULL;
-    }
-
-    free(task);
+    old_flags = __atomic_fetch_or(&task->flags, TASK_FLAG_REAPED, __ATOMIC_ACQ_REL);
+    if (old_flags & TASK_FLAG_TORNDOWN) task_retire(task);
 }
 
 void task_reparent(task_t* child, task_t* new_parent) {
@@ -364,52 +1014,48 @@ void task_reparent(task_t* child, task_t* new_parent) {
     new_parent->children = child;
 }
 
-void task_wakeup_waiters(uint32_t pid) {
-    task_t* to_wake[64];
-    int wake_count = 0;
-
-    uint64_t _irqf = spinlock_acquire_irqsave(&pid_lock);
-    for (uint32_t i = 1; i < MAX_PIDS && wake_count < 64; i++) {
-        task_t* t = pid_table[i];
-        if (!t) continue;
-        if (t->state != TASK_BLOCKED) continue;
-        if (t->wait_for_pid != pid && t->wait_for_pid != (uint32_t)-1) continue;
-
-        serial_printf("[SCHED] wakeup_waiters: waking pid=%u (waited for pid=%u)\n", t->pid, pid);
-
-        t->wait_for_pid = 0;
-        t->runnable = true;
-        t->state = TASK_READY;
-
-        to_wake[wake_count++] = t;
+void task_wakeup_waiters(task_t* child) {
+    uint64_t _cf = spinlock_acquire_irqsave(&children_lock);
+    task_t* parent = child->parent;
+    if (parent) {
+        int n = wait_wake_all(&parent->child_wq);
+        if (n)
+            serial_printf("[SCHED] wakeup_waiters: pid=%u exited, woke %d waiter(s) in pid=%u\n",
+                          child->pid, n, parent->pid);
     }
-    spinlock_release_irqrestore(&pid_lock, _irqf);
-
-    for (int i = 0; i < wake_count; i++)
-        enqueue_global(to_wake[i]);
+    spinlock_release_irqrestore(&children_lock, _cf);
 }
 
 __attribute__((noreturn)) void task_exit(void)
 {
-    asm volatile("cli");
-    uint32_t cpu = lapic_get_id();
-    percpu_t* pc = get_percpu();
-    task_t* me = pc ? (task_t*)pc->current_task : current_task[cpu];
+    task_t* me = this_task();
 
     if (!me) kernel_panic("task_exit: no current task");
 
+    if (me->fd_table) {
+        fd_table_t* fdt = me->fd_table;
+        me->fd_table = NULL;
+        fd_table_destroy(fdt);
+    }
+
+    asm volatile("cli");
+    uint32_t cpu = this_cpu_id();
+
     serial_printf("[EXIT] task_exit called cpu=%u me=%p pid=%u\n", cpu, (void*)me, me->pid);
 
     task_t* init = task_find_by_pid(1);
     if (init && init != me) {
         uint64_t _cf = spinlock_acquire_irqsave(&children_lock);
         task_t* child = me->children;
+        bool    orphan_zombie = false;
         me->children = NULL;
         while (child) {
             task_t* sib = child->sibling;
+            if (child->state == TASK_ZOMBIE) orphan_zombie = true;
             task_reparent(child, init);
             child = sib;
         }
+        if (orphan_zombie) wait_wake_all(&init->child_wq);
         spinlock_release_irqrestore(&children_lock, _cf);
     }
 
@@ -419,7 +1065,12 @@ __attribute__((noreturn)) void task_exit(void)
     me->state = TASK_ZOMBIE;
     me->cr3 = 0;
 
-    task_wakeup_waiters(me->pid);
+    task_dequeue(me);
+    if (me->sleep_slot)
+        sched_sleep_cancel(me);
+
+    __atomic_fetch_and(&me->flags, ~TASK_FLAG_VFORK, __ATOMIC_ACQ_REL);
+    task_wakeup_waiters(me);
 
     sched_reschedule();
 
@@ -441,7 +1092,7 @@ void task_kill(task_t* target) {
     target->pending_kill = true;
 
     if (target->state == TASK_BLOCKED) {
-        target->wakeup_time_ns = 0;
+        sched_sleep_cancel(target);
         task_unblock(target);
     }
 
@@ -451,7 +1102,6 @@ void task_kill(task_t* target) {
 
     for (uint32_t cpu = 0; cpu < smp_get_cpu_count(); cpu++) {
         if (current_task[cpu] == target) {
-            extern uint32_t smp_get_lapic_id_for_cpu(uint32_t);
             ipi_reschedule_cpu(smp_get_lapic_id_for_cpu(cpu));
         }
     }
@@ -474,65 +1124,218 @@ task_t* task_find_foreground(void) {
     return t;
 }
 
-static task_t* sched_pick_next(uint32_t cpu) {
-    uint64_t _irqf;
-
-    _irqf = spinlock_acquire_irqsave(&ready_queue_lock);
-    task_t* found = NULL;
-    for (int p = MAX_PRIORITY; p >= 0 && !found; p--) {
-        task_t** head = &ready_queues[p];
-        task_t*  t    = *head;
-        while (t) {
-            if (t->runnable && t->state != TASK_ZOMBIE && t->state != TASK_DEAD) {
-                bool expected = false;
-                if (atomic_cas_bool(&t->on_cpu, &expected, true)) {
-                    *head   = t->next;
-                    t->next = NULL;
-                    found   = t;
-                    break;
-                }
-            } else {
-                if (t->state == TASK_ZOMBIE || t->state == TASK_DEAD || !t->runnable) {
-                    *head = t->next;
-                    t->next = NULL;
-                    t = *head;
-                    continue;
-                }
-            }
-            head = &t->next;
-            t    = *head;
+/* Every entry is runnable, so this normally takes q->head. It only steps
+ * past an entry whose old CPU is still switching away from it, so a task
+ * queued behind it at the same priority still runs ahead of lower levels. */
+static task_t* rq_pop_list(runqueue_t* rq, rq_list_t* q, task_t* prev) {
+    for (task_t* t = q->head; t; t = t->next) {
+        bool expected = false;
+        if (t != prev && !atomic_cas_bool(&t->on_cpu, &expected, true))
+            continue;
+        rq_unlink(rq, t);
+        atomic_store_bool_rel(&t->on_rq, false);
+        return t;
+    }
+    return NULL;
+}
+
+static task_t* rq_pop_locked(runqueue_t* rq, task_t* prev) {
+    uint32_t pending = rq->bitmap;
+    while (pending) {
+        int p = rq_highest(pending);
+        pending &= ~(1U << p);
+        task_t* t = rq_pop_list(rq, &rq->queues[p], prev);
+        if (t) return t;
+    }
+    task_t* t = rq_pop_list(rq, &rq->fair, prev);
+    if (t && t->vruntime > rq->min_vruntime)
+        rq->min_vruntime = t->vruntime;
+    return t;
+}
+
+static uint32_t rq_detach_list(runqueue_t* victim, rq_list_t* q, rq_list_t* out,
+                               uint32_t thief, uint32_t want) {
+    uint32_t got = 0;
+    task_t*  t   = q->head;
+    while (t && got < want) {
+        task_t* nx = t->next;
+        if (task_queueable(t) && task_allowed_on(t, thief) &&
+            !atomic_load_bool_acq(&t->on_cpu)) {
+            rq_unlink(victim, t);
+            rq_list_append(out, t);
+            got++;
+        }
+        t = nx;
+    }
+    return got;
+}
+
+static uint32_t rq_detach_half(runqueue_t* victim, rq_list_t* out, uint32_t thief) {
+    uint32_t want    = (victim->nr_running + 1) / 2;
+    uint32_t got     = 0;
+    uint32_t pending = victim->bitmap;
+    while (pending && got < want) {
+        int p = rq_highest(pending);
+        pending &= ~(1U << p);
+        got += rq_detach_list(victim, &victim->queues[p], out, thief, want - got);
+    }
+    if (got < want)
+        got += rq_detach_list(victim, &victim->fair, out, thief, want - got);
+    return got;
+}
+
+static task_t* rq_steal(runqueue_t* rq) {
+    uint32_t ncpu = smp_get_cpu_count();
+    uint32_t self = 0;
+    for (uint32_t i = 0; i < ncpu; i++)
+        if (percpu_regions[i] && &percpu_regions[i]->rq == rq) { self = i; break; }
+
+    for (uint32_t n = 1; n < ncpu; n++) {
+        percpu_t* pc = percpu_regions[(self + n) % ncpu];
+        if (!pc) continue;
+        runqueue_t* victim = &pc->rq;
+        if (__atomic_load_n(&victim->nr_running, __ATOMIC_RELAXED) == 0) continue;
+        if (!spinlock_try_acquire(&victim->lock)) continue;
+        rq_list_t stolen = { NULL, NULL };
+        uint32_t  got    = rq_detach_half(victim, &stolen, self);
+        uint64_t  vbase  = victim->min_vruntime;
+        spinlock_release(&victim->lock);
+        if (!got) continue;
+
+        __atomic_fetch_add(&steal_count, got, __ATOMIC_RELAXED);
+        spinlock_acquire(&rq->lock);
+        while (stolen.head) {
+            task_t* t = stolen.head;
+            rq_list_del(&stolen, t);
+            if (t->sched_class == SCHED_CLASS_FAIR)
+                t->vruntime = (t->vruntime > vbase ? t->vruntime - vbase : 0) + rq->min_vruntime;
+            t->nr_migrations++;
+            sched_trace_event(SCHED_EV_MIGRATE, t->pid, (self + n) % ncpu, self);
+            rq_push(rq, t);
         }
+        task_t* found = rq_pop_locked(rq, NULL);
+        spinlock_release(&rq->lock);
+        if (found) return found;
     }
-    spinlock_release_irqrestore(&ready_queue_lock, _irqf);
+    return NULL;
+}
+
+static task_t* sched_pick_next(uint32_t cpu, task_t* prev) {
+    runqueue_t* rq = this_rq();
+
+    uint64_t _irqf = spinlock_acquire_irqsave(&rq->lock);
+    if (prev) {
+        prev->time_slice = prev->time_slice_init;
+        prev->last_cpu   = cpu;
+        prev->state      = TASK_READY;
+        if (rq_claim(prev)) rq_push(rq, prev);
+    }
+    task_t* found = rq_pop_locked(rq, prev);
+    spinlock_release_irqrestore(&rq->lock, _irqf);
+
+    if (!found) found = rq_steal(rq);
     return found ? found : &idle_tasks[cpu];
 }
 
+bool sched_tick(task_t* cur) {
+    uint32_t cpu = this_cpu_id();
+    if (cur->sched_class != SCHED_CLASS_FIFO && cur->time_slice > 0)
+        cur->time_slice--;
+    if (cur == &idle_tasks[cpu])
+        return cur->time_slice == 0;
+
+    update_curr(cur, sched_clock_ns());
+    if (cur->sched_class != SCHED_CLASS_FIFO && cur->time_slice == 0) return true;
+
+    runqueue_t* rq = this_rq();
+    spinlock_acquire(&rq->lock);
+    bool preempt;
+    if (sched_class_is_rt(cur->sched_class)) {
+        preempt = rq->bitmap && rq_highest(rq->bitmap) > cur->priority;
+    } else {
+        preempt = rq->bitmap != 0;
+        if (!preempt && rq->fair.head && rq->fair.head != cur)
+            preempt = rq->fair.head->vruntime + SCHED_FAIR_GRAN_NS < cur->vruntime;
+    }
+    spinlock_release(&rq->lock);
+    return preempt;
+}
+
+int sched_set_class(task_t* t, int sched_class, int priority) {
+    if (!t) return -1;
+    if (sched_class != SCHED_CLASS_FAIR && !sched_class_is_rt((uint8_t)sched_class)) return -1;
+    if (priority < 0 || priority > MAX_PRIORITY) return -1;
+
+    bool was_rt = sched_class_is_rt(t->sched_class);
+    bool now_rt = sched_class_is_rt((uint8_t)sched_class);
+    if (now_rt && !was_rt && !rt_admit(t)) return -2;
+    if (was_rt && !now_rt) rt_release(t);
+
+    bool queued = atomic_load_bool_acq(&t->on_rq);
+    if (queued) rq_remove_task(t);
+    if (was_rt && !now_rt) {
+        runqueue_t* rq = this_rq();
+        t->vruntime = rq->min_vruntime;
+    }
+    t->sched_class = (uint8_t)sched_class;
+    t->priority    = priority;
+    t->time_slice  = t->time_slice_init;
+    if (queued && task_queueable(t)) enqueue_task(t);
+
+    uint32_t self = this_cpu_id();
+    for (uint32_t cpu = 0; cpu < smp_get_cpu_count(); cpu++) {
+        if (current_task[cpu] == t && cpu != self)
+            ipi_reschedule_cpu(smp_get_lapic_id_for_cpu(cpu));
+    }
+    return 0;
+}
+
 void sched_reschedule(void) {
     asm volatile("cli");
 
     process_deferred_free();
+    sched_quiescent();
 
     reschedule_calls++;
-    uint32_t cpu  = lapic_get_id();
+    uint32_t cpu  = this_cpu_id();
 
-    task_t*  old  = current_task[cpu];
-    task_t*  next = sched_pick_next(cpu);
+    task_t*  old  = this_task();
+    uint64_t now  = sched_clock_ns();
+    bool requeue  = old && old != &idle_tasks[cpu] &&
+                    task_queueable(old) && task_allowed_on(old, cpu);
+    if (old && old != &idle_tasks[cpu])
+        update_curr(old, now);
 
-    if (!next) { asm volatile("sti"); return; }
+    task_t*  next = sched_pick_next(cpu, requeue ? old : NULL);
 
     if (old == next) {
-        if (old == &idle_tasks[cpu]) {
-            next = sched_pick_next(cpu);
-            if (next == &idle_tasks[cpu]) {
-                asm volatile("sti");
-                return;
-            }
-        } else {
-            old->time_slice = old->time_slice_init;
-            asm volatile("sti");
-            return;
-        }
+        if (old != &idle_tasks[cpu]) old->state = TASK_RUNNING;
+        asm volatile("sti");
+        return;
     }
+    next->exec_start = now;
+    uint32_t delay_us = 0;
+    if (next->queued_tsc) {
+        uint64_t delay = sched_trace_tsc_to_ns(sched_rdtsc() - next->queued_tsc);
+        next->queued_tsc    = 0;
+        next->wait_time_ns += delay;
+        delay_us = delay / 1000 > UINT32_MAX ? UINT32_MAX : (uint32_t)(delay / 1000);
+        sched_trace_latency(delay);
+    }
+    if (old && old != &idle_tasks[cpu]) {
+        if (task_queueable(old)) old->nivcsw++;
+        else                     old->nvcsw++;
+    }
+    sched_trace_event(SCHED_EV_SWITCH, next->pid, old ? old->pid : 0, delay_us);
+    if (next->wake_stamp) {
+        uint64_t lat = now > next->wake_stamp ? now - next->wake_stamp : 0;
+        next->wake_stamp = 0;
+        rt_wakeups++;
+        if (lat > rt_latency_max_ns) rt_latency_max_ns = lat;
+    }
+
+    if (old == &idle_tasks[cpu])
+        sched_nohz_exit(cpu);
 
     if (old && old->fpu_state && old->state != TASK_ZOMBIE && old->state != TASK_DEAD) {
         fpu_save(old->fpu_state);
@@ -543,11 +1346,11 @@ void sched_reschedule(void) {
         if (old->state == TASK_ZOMBIE) {
             percpu_t* pc = get_percpu();
             if (pc) pc->deferred_free_task = old;
-        } else if (old->runnable && old->state != TASK_DEAD) {
+        } else if (!requeue && old->runnable && old->state != TASK_DEAD) {
             old->time_slice = old->time_slice_init;
             old->last_cpu   = cpu;
             old->state      = TASK_READY;
-            enqueue_global(old);
+            enqueue_task(old);
         }
     }
 
@@ -566,6 +1369,9 @@ void sched_reschedule(void) {
         }
     }
 
+    if (switch_cr3)
+        vmm_pagemap_activate(next->cr3 ? next->pagemap : NULL);
+
     if (tss[cpu]) {
         if (next->is_userspace && next->stack_base == 0) {
             kernel_panic("SCHED: userspace task has stack_base=0");
@@ -583,6 +1389,9 @@ void sched_reschedule(void) {
     next->cpu_id = cpu;
     next->state  = TASK_RUNNING;
     if (next->fpu_state) fpu_restore(next->fpu_state);
+    if (old && old->is_userspace) old->fs_base = fs_base_read();
+    if (next->is_userspace && (!old || !old->is_userspace || old->fs_base != next->fs_base))
+        fs_base_write(next->fs_base);
 
     if (!(next->flags & TASK_FLAG_STARTED)) {
         next->flags |= TASK_FLAG_STARTED;
@@ -603,6 +1412,10 @@ void sched_reschedule(void) {
         }
     }
 
+    percpu_t* self_pc = this_cpu();
+    if (old) old->preempt_count = self_pc->preempt_count;
+    self_pc->preempt_count = next->preempt_count;
+
     if (old) context_switch(old, next, &current_task[cpu], switch_cr3);
     else     context_switch(&bootstrap_tasks[cpu], next, &current_task[cpu], switch_cr3);
 
@@ -611,59 +1424,221 @@ void sched_reschedule(void) {
     asm volatile("sti");
 }
 
+static inline bool preempt_would_lose(percpu_t* pc) {
+    task_t* me = (task_t*)pc->current_task;
+    return me && me != &idle_tasks[pc->cpu_id] && !task_queueable(me);
+}
+
+void preempt_schedule(void) {
+    uint64_t rflags;
+    asm volatile("pushfq; pop %0" : "=r"(rflags));
+    if (!(rflags & (1ULL << 9))) return;
+    percpu_t* pc = this_cpu();
+    if (pc->preempt_count || !pc->need_resched) return;
+    if (preempt_would_lose(pc)) return;
+    pc->need_resched = false;
+    sched_reschedule();
+}
+
+void preempt_schedule_irq(void) {
+    for (;;) {
+        percpu_t* pc = this_cpu();
+        if (!pc->need_resched || preempt_would_lose(pc)) return;
+        pc->need_resched = false;
+        sched_reschedule();
+        asm volatile("cli");
+    }
+}
+
 void task_yield(void) {
+    percpu_t* pc = get_percpu();
+    task_t*   me = pc ? (task_t*)pc->current_task : NULL;
+    if (me && me->sched_class == SCHED_CLASS_FAIR) {
+        runqueue_t* rq = this_rq();
+        uint64_t f = spinlock_acquire_irqsave(&rq->lock);
+        if (rq->fair.tail && rq->fair.tail->vruntime > me->vruntime)
+            me->vruntime = rq->fair.tail->vruntime;
+        spinlock_release_irqrestore(&rq->lock, f);
+    }
     sched_reschedule();
 }
 
 void sched_print_stats(void) {
-    uint64_t _irqf;
-    serial_printf("[SCHED] reschedule_calls=%llu\n", reschedule_calls);
-    _irqf = spinlock_acquire_irqsave(&ready_queue_lock);
-    for (int p = MAX_PRIORITY; p >= 0; p--) {
-        int n = 0;
-        for (task_t* t = ready_queues[p]; t; t = t->next) n++;
-        if (n) serial_printf("  prio %d: %d tasks\n", p, n);
+    serial_printf("[SCHED] reschedule_calls=%llu steals=%llu\n",
+                  reschedule_calls, steal_count);
+    serial_printf("[SCHED] rt tasks=%u wakeups=%llu max wakeup latency=%llu ns\n",
+                  rt_admitted_total(), rt_wakeups, rt_latency_max_ns);
+    serial_printf("[SCHED] stacks reused=%llu\n", kstack_reused);
+    sched_trace_print();
+    for (uint32_t i = 0; i < smp_get_cpu_count(); i++) {
+        percpu_t* pc = percpu_regions[i];
+        if (!pc) continue;
+        runqueue_t* rq = &pc->rq;
+        uint64_t _irqf = spinlock_acquire_irqsave(&rq->lock);
+        serial_printf(" cpu %u: %u queued bitmap=0x%08x fair=%u min_vruntime=%llu\n",
+                      i, rq->nr_running, rq->bitmap, rq->nr_fair, rq->min_vruntime);
+        for (int p = MAX_PRIORITY; p >= 0; p--) {
+            int n = 0;
+            for (task_t* t = rq->queues[p].head; t; t = t->next) n++;
+            if (n) serial_printf("  prio %d: %d tasks\n", p, n);
+        }
+        spinlock_release_irqrestore(&rq->lock, _irqf);
     }
-    spinlock_release_irqrestore(&ready_queue_lock, _irqf);
+}
+
+uint64_t sched_online_mask(void) {
+    uint32_t n = smp_get_cpu_count();
+    return n >= 64 ? ~0ULL : ((1ULL << n) - 1);
+}
+
+int sched_set_affinity(task_t* t, uint64_t mask) {
+    if (!t) return -1;
+    if (mask == sched_online_mask()) mask = 0;
+    else if (!(mask & sched_online_mask())) return -1;
+
+    uint64_t old_mask = t->cpu_affinity;
+    __atomic_store_n(&t->cpu_affinity, mask, __ATOMIC_RELEASE);
+    if (sched_class_is_rt(t->sched_class) && !task_allowed_on(t, t->rt_cpu)) {
+        uint32_t old_cpu = t->rt_cpu;
+        if (!rt_admit(t)) {
+            __atomic_store_n(&t->cpu_affinity, old_mask, __ATOMIC_RELEASE);
+            return -2;
+        }
+        __atomic_fetch_sub(&percpu_regions[old_cpu]->rq.nr_rt_admitted, 1, __ATOMIC_RELAXED);
+    }
+
+    if (atomic_load_bool_acq(&t->on_rq)) {
+        runqueue_t* rq = __atomic_load_n(&t->rq, __ATOMIC_ACQUIRE);
+        for (uint32_t i = 0; rq && i < smp_get_cpu_count(); i++) {
+            if (!percpu_regions[i] || &percpu_regions[i]->rq != rq) continue;
+            if (!task_allowed_on(t, i)) {
+                rq_remove_task(t);
+                if (task_queueable(t)) enqueue_task(t);
+            }
+            break;
+        }
+    }
+
+    for (uint32_t cpu = 0; cpu < smp_get_cpu_count(); cpu++) {
+        if (current_task[cpu] == t && !task_allowed_on(t, cpu))
+            ipi_reschedule_single(smp_get_lapic_id_for_cpu(cpu));
+    }
+    return 0;
+}
+
+void task_block(task_t* t) {
+    if (!t) return;
+    t->runnable = false;
+    t->state    = TASK_BLOCKED;
+    task_dequeue(t);
 }
 
 void task_unblock(task_t* t) {
     if (!t) return;
     t->runnable = true;
     t->state    = TASK_READY;
-    enqueue_global(t);
+    enqueue_task(t);
 }
 
 void sched_wakeup_sleepers(uint64_t now_ns) {
     task_t* to_wake[64];
-    int     wake_count = 0;
-
-    uint64_t _irqf = spinlock_acquire_irqsave(&pid_lock);
-    for (uint32_t i = 1; i < MAX_PIDS && wake_count < 64; i++) {
-        task_t *t = pid_table[i];
-        if (!t) continue;
-        if (t->state != TASK_BLOCKED) continue;
-        if (t->wakeup_time_ns == 0) continue;
-        if (now_ns >= t->wakeup_time_ns) {
+    int     wake_count;
+
+    do {
+        wake_count = 0;
+        uint64_t _irqf = spinlock_acquire_irqsave(&sleep_lock);
+        while (sleep_count && wake_count < 64 &&
+               sleep_heap[0]->wakeup_time_ns <= now_ns) {
+            task_t* t = sleep_heap[0];
+            sleep_heap_remove(t);
             t->wakeup_time_ns = 0;
+            if (t->state != TASK_BLOCKED) continue;
             t->runnable = true;
             t->state    = TASK_READY;
             to_wake[wake_count++] = t;
         }
+        spinlock_release_irqrestore(&sleep_lock, _irqf);
+
+        for (int i = 0; i < wake_count; i++)
+            enqueue_task(to_wake[i]);
+    } while (wake_count == 64);
+}
+
+int sched_nohz_enter(uint32_t cpu) {
+    percpu_t* pc = get_percpu();
+    if (!pc || !apic_timer_period) return 0;
+    if (__atomic_load_n(&pc->rq.nr_running, __ATOMIC_RELAXED)) return -1;
+    if (cpu == 0 && g_ctrlc_pending) return 0;
+
+    uint64_t bit = 1ULL << (cpu % 64);
+    __atomic_fetch_or(&nohz_idle_mask[cpu / 64], bit, __ATOMIC_SEQ_CST);
+    for (uint32_t i = 0; i < smp_get_cpu_count(); i++) {
+        percpu_t* other = percpu_regions[i];
+        if (other && __atomic_load_n(&other->rq.nr_running, __ATOMIC_RELAXED)) {
+            __atomic_fetch_and(&nohz_idle_mask[cpu / 64], ~bit, __ATOMIC_RELEASE);
+            return 0;
+        }
     }
-    spinlock_release_irqrestore(&pid_lock, _irqf);
 
-    for (int i = 0; i < wake_count; i++) {
-        enqueue_global(to_wake[i]);
+    uint64_t deadline = 0;
+    if (cpu == 0 && hpet_is_available()) {
+        uint64_t f = spinlock_acquire_irqsave(&sleep_lock);
+        if (sleep_count) deadline = sleep_heap[0]->wakeup_time_ns;
+        spinlock_release_irqrestore(&sleep_lock, f);
     }
+
+    if (deadline) {
+        uint64_t now = hpet_elapsed_ns();
+        apic_timer_oneshot_ns(deadline > now ? deadline - now : 1);
+    } else {
+        lapic_timer_stop();
+    }
+    pc->tick_stopped = true;
+    rcu_note_qs(pc);
+    __atomic_store_n(&pc->rcu_nohz, true, __ATOMIC_SEQ_CST);
+    return 1;
+}
+
+void sched_irq_enter(void) {
+    if (!g_percpu_ready) return;
+    percpu_t* pc = this_cpu();
+    if (__atomic_load_n(&pc->rcu_nohz, __ATOMIC_RELAXED))
+        __atomic_store_n(&pc->rcu_nohz, false, __ATOMIC_SEQ_CST);
+}
+
+void sched_nohz_kick(uint32_t cpu) {
+    nohz_kick_cpu(cpu);
+}
+
+void sched_nohz_exit(uint32_t cpu) {
+    __atomic_fetch_and(&nohz_idle_mask[cpu / 64], ~(1ULL << (cpu % 64)), __ATOMIC_RELEASE);
+    percpu_t* pc = get_percpu();
+    if (!pc) return;
+    __atomic_store_n(&pc->rcu_nohz, false, __ATOMIC_SEQ_CST);
+    if (!pc->tick_stopped) return;
+    pc->tick_stopped = false;
+    apic_timer_periodic();
 }
 
 static void idle_loop(void* arg) {
     (void)arg;
-    uint32_t cpu = lapic_get_id();
+    uint32_t cpu = this_cpu_id();
     serial_printf("[IDLE] CPU %u entering idle loop\n", cpu);
     while (1) {
-        process_deferred_free();
+        sched_reclaim();
+        pmm_zero_idle();
+        asm volatile("cli");
+        int nohz = sched_nohz_enter(cpu);
+        if (nohz < 0) {
+            asm volatile("sti");
+            task_yield();
+            continue;
+        }
         asm volatile("sti; hlt");
+        if (nohz) {
+            asm volatile("cli");
+            sched_nohz_exit(cpu);
+            asm volatile("sti");
+        }
     }
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 section .text
 extern task_exit
+extern fpu_save_mode
+extern fpu_xcr0
 global context_switch
 global first_task_start
 global fpu_save
@@ -77,10 +79,31 @@ first_task_start:
     ret
 
 fpu_save:
+    mov  ecx, [rel fpu_save_mode]
+    test ecx, ecx
+    jz   .fx
+    mov  eax, [rel fpu_xcr0]
+    mov  edx, [rel fpu_xcr0 + 4]
+    cmp  ecx, 2
+    jne  .xs
+    xsaveopt [rdi]
+    ret
+.xs:
+    xsave [rdi]
+    ret
+.fx:
     fxsave [rdi]
     ret
 
 fpu_restore:
+    mov  ecx, [rel fpu_save_mode]
+    test ecx, ecx
+    jz   .fx
+    mov  eax, [rel fpu_xcr0]
+    mov  edx, [rel fpu_xcr0 + 4]
+    xrstor [rdi]
+    ret
+.fx:
     fxrstor [rdi]
     ret
 
@@ -0,0 +1,164 @@
+#include "../include/sched/sched_trace.h"
+#include "../include/sched/sched.h"
+#include "../include/smp/percpu.h"
+#include "../include/smp/smp.h"
+#include "../include/apic/apic.h"
+#include "../include/fs/devfs.h"
+#include "../include/io/serial.h"
+#include "../include/syscall/errno.h"
+#include <string.h>
+#include <stdlib.h>
+
+typedef struct {
+    volatile uint64_t    head;
+    uint64_t             tail;
+    uint64_t             hist[SCHED_LAT_BUCKETS];
+    cervus_sched_event_t ev[SCHED_TRACE_ENTRIES];
+} sched_trace_ring_t;
+
+static sched_trace_ring_t* trace_rings[MAX_CPUS];
+static spinlock_t          trace_read_lock = SPINLOCK_INIT;
+static uint64_t            tsc_ns_mult = 1ULL << 32;
+static vnode_t             trace_node;
+
+static inline uint64_t irq_save(void) {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint64_t flags) {
+    asm volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
+}
+
+static inline sched_trace_ring_t* this_ring(void) {
+    if (!g_percpu_ready) return NULL;
+    uint32_t cpu = this_cpu_id();
+    return cpu < MAX_CPUS ? trace_rings[cpu] : NULL;
+}
+
+void sched_trace_event(uint16_t type, uint32_t pid, uint32_t arg, uint32_t arg2) {
+    sched_trace_ring_t* r = this_ring();
+    if (!r) return;
+    uint64_t f = irq_save();
+    uint64_t h = r->head;
+    cervus_sched_event_t* e = &r->ev[h & (SCHED_TRACE_ENTRIES - 1)];
+    e->tsc  = sched_rdtsc();
+    e->pid  = pid;
+    e->arg  = arg;
+    e->type = type;
+    e->cpu  = (uint16_t)this_cpu_id();
+    e->arg2 = arg2;
+    __atomic_store_n(&r->head, h + 1, __ATOMIC_RELEASE);
+    irq_restore(f);
+}
+
+void sched_trace_latency(uint64_t ns) {
+    sched_trace_ring_t* r = this_ring();
+    if (!r) return;
+    uint64_t us = ns / 1000;
+    uint32_t b  = us ? 64 - (uint32_t)__builtin_clzll(us) : 0;
+    if (b >= SCHED_LAT_BUCKETS) b = SCHED_LAT_BUCKETS - 1;
+    __atomic_fetch_add(&r->hist[b], 1, __ATOMIC_RELAXED);
+}
+
+uint64_t sched_trace_tsc_to_ns(uint64_t cycles) {
+    return (uint64_t)(((unsigned __int128)cycles * tsc_ns_mult) >> 32);
+}
+
+static size_t trace_drain(sched_trace_ring_t* r, cervus_sched_event_t* out, size_t max) {
+    uint64_t h     = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    uint64_t start = r->tail;
+    if (h - start > SCHED_TRACE_ENTRIES) start = h - SCHED_TRACE_ENTRIES;
+    size_t n = (size_t)(h - start);
+    if (n > max) n = max;
+    for (size_t i = 0; i < n; i++)
+        out[i] = r->ev[(start + i) & (SCHED_TRACE_ENTRIES - 1)];
+
+    uint64_t h2 = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    /* The writer fills slot h2 before publishing h2 + 1, so that slot may
+     * already be overwriting the entry SCHED_TRACE_ENTRIES behind it. */
+    if (h2 + 1 - start > SCHED_TRACE_ENTRIES) {
+        size_t lost = (size_t)(h2 + 1 - SCHED_TRACE_ENTRIES - start);
+        if (lost > n) lost = n;
+        memmove(out, out + lost, (n - lost) * sizeof(*out));
+        start += lost;
+        n     -= lost;
+    }
+    r->tail = start + n;
+    return n;
+}
+
+static int64_t trace_read(vnode_t* node, void* buf, size_t len, uint64_t offset) {
+    (void)node; (void)offset;
+    size_t max = len / sizeof(cervus_sched_event_t);
+    if (!max) return -EINVAL;
+    cervus_sched_event_t* out = buf;
+    size_t got = 0;
+    uint64_t f = spinlock_acquire_irqsave(&trace_read_lock);
+    for (uint32_t i = 0; i < smp_get_cpu_count() && got < max; i++)
+        if (trace_rings[i]) got += trace_drain(trace_rings[i], out + got, max - got);
+    spinlock_release_irqrestore(&trace_read_lock, f);
+    return (int64_t)(got * sizeof(cervus_sched_event_t));
+}
+
+static int trace_stat(vnode_t* node, vfs_stat_t* out) {
+    memset(out, 0, sizeof(*out));
+    out->st_ino  = node->ino;
+    out->st_type = node->type;
+    out->st_mode = node->mode;
+    return 0;
+}
+
+static void trace_ref(vnode_t* n)   { (void)n; }
+static void trace_unref(vnode_t* n) { (void)n; }
+
+static const vnode_ops_t trace_ops = {
+    .read = trace_read, .stat = trace_stat, .ref = trace_ref, .unref = trace_unref,
+};
+
+static void tsc_calibrate(void) {
+    if (!hpet_is_available()) return;
+    uint64_t t0 = hpet_elapsed_ns();
+    uint64_t c0 = sched_rdtsc();
+    while (hpet_elapsed_ns() - t0 < 10000000ULL)
+        asm volatile("pause");
+    uint64_t dt = hpet_elapsed_ns() - t0;
+    uint64_t dc = sched_rdtsc() - c0;
+    if (dc) tsc_ns_mult = (uint64_t)(((unsigned __int128)dt << 32) / dc);
+}
+
+void sched_trace_init(void) {
+    tsc_calibrate();
+    uint32_t n = smp_get_cpu_count();
+    for (uint32_t i = 0; i < n && i < MAX_CPUS; i++) {
+        trace_rings[i] = malloc(sizeof(sched_trace_ring_t));
+        if (trace_rings[i]) memset(trace_rings[i], 0, sizeof(sched_trace_ring_t));
+    }
+
+    memset(&trace_node, 0, sizeof(trace_node));
+    trace_node.type     = VFS_NODE_CHARDEV;
+    trace_node.mode     = 0440;
+    trace_node.ino      = 400;
+    trace_node.ops      = &trace_ops;
+    trace_node.refcount = 1;
+    devfs_register("schedtrace", &trace_node);
+
+    serial_printf("[SCHED] trace: %u rings x %u events, tsc mult=0x%llx\n",
+                  n, SCHED_TRACE_ENTRIES, tsc_ns_mult);
+}
+
+void sched_trace_print(void) {
+    uint64_t total[SCHED_LAT_BUCKETS] = {0};
+    for (uint32_t i = 0; i < smp_get_cpu_count(); i++) {
+        if (!trace_rings[i]) continue;
+        for (int b = 0; b < SCHED_LAT_BUCKETS; b++)
+            total[b] += __atomic_load_n(&trace_rings[i]->hist[b], __ATOMIC_RELAXED);
+    }
+    serial_printf("[SCHED] run-queue delay histogram (us):\n");
+    for (int b = 0; b < SCHED_LAT_BUCKETS; b++) {
+        if (!total[b]) continue;
+        if (b == 0) serial_printf("  <1: %llu\n", total[b]);
+        else        serial_printf("  <%llu: %llu\n", 1ULL << b, total[b]);
+    }
+}
@@ -0,0 +1,124 @@
+#include "../include/sched/wait.h"
+#include "../include/sched/sched.h"
+#include "../include/smp/percpu.h"
+#include "../include/apic/apic.h"
+#include "../include/panic/panic.h"
+#include "../include/syscall/errno.h"
+
+static inline task_t* wait_cur_task(void) {
+    percpu_t* pc = get_percpu();
+    return pc ? (task_t*)pc->current_task : NULL;
+}
+
+static void wq_append(wait_queue_t* wq, wait_entry_t* e) {
+    e->next = NULL;
+    e->prev = wq->tail;
+    if (wq->tail) wq->tail->next = e;
+    else          wq->head       = e;
+    wq->tail  = e;
+    e->queued = true;
+}
+
+static void wq_del(wait_queue_t* wq, wait_entry_t* e) {
+    if (e->prev) e->prev->next = e->next;
+    else         wq->head      = e->next;
+    if (e->next) e->next->prev = e->prev;
+    else         wq->tail      = e->prev;
+    e->next = e->prev = NULL;
+    e->queued = false;
+}
+
+void wait_queue_init(wait_queue_t* wq) {
+    wq->lock = (spinlock_t)SPINLOCK_INIT;
+    wq->head = wq->tail = NULL;
+}
+
+void wait_prepare(wait_queue_t* wq, wait_entry_t* e) {
+    task_t* me = wait_cur_task();
+    if (!me) kernel_panic("wait_prepare: no current task");
+
+    uint64_t f = spinlock_acquire_irqsave(&wq->lock);
+    if (!e->queued) {
+        e->task = me;
+        wq_append(wq, e);
+    }
+    task_block(me);
+    spinlock_release_irqrestore(&wq->lock, f);
+}
+
+void wait_sleep(wait_entry_t* e) {
+    if (e->queued)
+        sched_reschedule();
+}
+
+/* Deadlines are on the HPET clock the sleep heap is driven by. Without
+ * an HPET a timed sleep cannot be honoured, so it is refused with
+ * -ENOSYS instead of silently becoming an untimed one. */
+int wait_sleep_until(wait_entry_t* e, uint64_t deadline_ns) {
+    if (deadline_ns && !hpet_is_available()) return -ENOSYS;
+    if (!e->queued) return 0;
+    if (!deadline_ns) {
+        sched_reschedule();
+        return 0;
+    }
+    sched_sleep_until(e->task, deadline_ns);
+    sched_reschedule();
+    sched_sleep_cancel(e->task);
+    return 0;
+}
+
+bool wait_finish(wait_queue_t* wq, wait_entry_t* e) {
+    uint64_t f = spinlock_acquire_irqsave(&wq->lock);
+    bool still_queued = e->queued;
+    if (still_queued) wq_del(wq, e);
+    task_t* me = e->task;
+    if (me) {
+        me->runnable = true;
+        me->state    = TASK_RUNNING;
+    }
+    spinlock_release_irqrestore(&wq->lock, f);
+    return still_queued;
+}
+
+int wait_wake_one(wait_queue_t* wq) {
+    int n = 0;
+    uint64_t f = spinlock_acquire_irqsave(&wq->lock);
+    wait_entry_t* e = wq->head;
+    if (e) {
+        wq_del(wq, e);
+        task_unblock(e->task);
+        n = 1;
+    }
+    spinlock_release_irqrestore(&wq->lock, f);
+    return n;
+}
+
+int wait_wake_all(wait_queue_t* wq) {
+    int n = 0;
+    uint64_t f = spinlock_acquire_irqsave(&wq->lock);
+    while (wq->head) {
+        wait_entry_t* e = wq->head;
+        wq_del(wq, e);
+        task_unblock(e->task);
+        n++;
+    }
+    spinlock_release_irqrestore(&wq->lock, f);
+    return n;
+}
+
+int wait_wake_key(wait_queue_t* wq, uint64_t key, int nr) {
+    int n = 0;
+    uint64_t f = spinlock_acquire_irqsave(&wq->lock);
+    wait_entry_t* e = wq->head;
+    while (e && n < nr) {
+        wait_entry_t* nx = e->next;
+        if (e->key == key) {
+            wq_del(wq, e);
+            task_unblock(e->task);
+            n++;
+        }
+        e = nx;
+    }
+    spinlock_release_irqrestore(&wq->lock, f);
+    return n;
+}
@@ -14,6 +14,7 @@ PERCPU_SECTION int dummy_percpu = 0xDEADBEEF;
 percpu_t* percpu_regions[MAX_CPUS] = {0};
 
 bool g_has_fsgsbase = false;
+volatile bool g_percpu_ready = false;
 
 #define MSR_GS_BASE         0xC0000101
 #define MSR_KERNEL_GS_BASE  0xC0000102
@@ -40,7 +41,7 @@ void init_percpu_regions(void) {
     g_has_fsgsbase = detect_fsgsbase();
     serial_printf("[PerCPU] FSGSBASE: %s\n", g_has_fsgsbase ? "YES" : "NO (using MSR fallback)");
 
-    size_t percpu_size = &__percpu_end - &__percpu_start;
+    size_t percpu_size = (uintptr_t)&__percpu_end - (uintptr_t)&__percpu_start;
     serial_printf("PerCPU size: %zu bytes\n", percpu_size);
 
     smp_info_t* info = smp_get_info();
@@ -55,6 +56,7 @@ void init_percpu_regions(void) {
 
         percpu_regions[i] = (percpu_t*)region;
         percpu_regions[i]->cpu_id = info->cpus[i].lapic_id;
+        percpu_regions[i]->self   = percpu_regions[i];
         percpu_regions[i]->syscall_kernel_rsp = 0;
         percpu_regions[i]->syscall_user_rsp   = 0;
 
@@ -63,6 +65,7 @@ void init_percpu_regions(void) {
 }
 
 percpu_t* get_percpu(void) {
+    if (__builtin_expect(g_percpu_ready, 1)) return this_cpu();
     uint64_t gs_base;
     if (g_has_fsgsbase) {
         asm volatile("rdgsbase %0" : "=r"(gs_base));
@@ -79,10 +82,6 @@ percpu_t* get_percpu_mut(void) {
 
 void set_percpu_base(percpu_t* base) {
     uint64_t val = (uint64_t)base;
-    if (g_has_fsgsbase) {
-        asm volatile("wrgsbase %0" :: "r"(val) : "memory");
-    } else {
-        wrmsr_local(MSR_GS_BASE, val);
-    }
+    wrmsr_local(MSR_GS_BASE, val);
     wrmsr_local(MSR_KERNEL_GS_BASE, val);
 }
@@ -54,21 +54,23 @@ void ap_entry_init(struct limine_mp_info* cpu_info) {
             break;
         }
     }
+    percpu_t* region = percpu_regions[info->cpus[my_index].cpu_index];
+    set_percpu_base(region);
+
     load_tss(info->cpus[my_index].tss_selector);
+    serial_printf("PerCPU base set for AP %u: 0x%llx\n",
+                  lapic_id, (uint64_t)region);
     serial_printf("TSS Loaded (selector 0x%x)\n", info->cpus[my_index].tss_selector);
 
     fpu_init();
     sse_init();
+    fpu_xsave_init();
     enable_fsgsbase();
+
     lapic_enable();
     apic_timer_calibrate();
     serial_printf("[SMP] AP %u LAPIC timer started\n", lapic_id);
 
-    cpu_info_t* cpu = smp_get_current_cpu();
-    percpu_t* region = percpu_regions[cpu->cpu_index];
-    set_percpu_base(region);
-    serial_printf("PerCPU base set for AP %u: 0x%llx\n",
-                  lapic_id, (uint64_t)region);
     syscall_init();
     __sync_fetch_and_add(&ap_online_count, 1);
     lapic_eoi();
@@ -265,10 +267,11 @@ void smp_init(struct limine_mp_response* mp_response) {
 
     smp_print_info();
     init_percpu_regions();
-    smp_boot_aps(mp_response);
     set_percpu_base(percpu_regions[bsp_index]);
+    g_percpu_ready = true;
     serial_printf("PerCPU base set for BSP %u: 0x%llx\n",
                   smp_info.bsp_lapic_id, (uint64_t)percpu_regions[bsp_index]);
+    smp_boot_aps(mp_response);
     serial_writestring("[SMP] Initialization Complete \n\n");
 }
 
@@ -3,6 +3,12 @@
 
 #define COM1 0x3F8
 
+#define FPU_STATE_MAX 4096
+
+uint32_t fpu_save_mode  = FPU_SAVE_FXSAVE;
+uint32_t fpu_state_size = 512;
+uint64_t fpu_xcr0       = 0;
+
 void fpu_init(void) {
     serial_writestring("[FPU] Initializing x87 FPU...\n");
 
@@ -93,4 +99,47 @@ uint16_t fpu_get_tag_word(void) {
 
     asm volatile("fstenv %0" : "=m"(fpu_env));
     return fpu_env.tag_word;
-}
\ No newline at end of file
+}
+
+static inline void fpu_cpuid(uint32_t leaf, uint32_t sub,
+                             uint32_t* a, uint32_t* b, uint32_t* c, uint32_t* d) {
+    asm volatile("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(sub));
+}
+
+void fpu_xsave_init(void) {
+    uint32_t a, b, c, d;
+    fpu_cpuid(0, 0, &a, &b, &c, &d);
+    if (a < 0xD) return;
+
+    fpu_cpuid(1, 0, &a, &b, &c, &d);
+    if (!(c & (1U << 26)) || !(c & (1U << 27))) return;
+
+    uint32_t lo, hi;
+    asm volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    uint64_t xcr0 = ((uint64_t)hi << 32) | lo;
+
+    fpu_cpuid(0xD, 0, &a, &b, &c, &d);
+    uint32_t size = b;
+    if (size > FPU_STATE_MAX) {
+        serial_printf("[FPU] XSAVE area %u bytes too large, using FXSAVE\n", size);
+        return;
+    }
+
+    fpu_cpuid(0xD, 1, &a, &b, &c, &d);
+    uint32_t mode = (a & 1U) ? FPU_SAVE_XSAVEOPT : FPU_SAVE_XSAVE;
+
+    if (fpu_save_mode == mode && fpu_xcr0 == xcr0) return;
+    fpu_xcr0       = xcr0;
+    fpu_state_size = size;
+    fpu_save_mode  = mode;
+    serial_printf("[FPU] %s enabled: xcr0=0x%llx area=%u bytes\n",
+                  mode == FPU_SAVE_XSAVEOPT ? "XSAVEOPT" : "XSAVE", xcr0, size);
+}
+
+void fpu_state_init(void* area) {
+    uint8_t* p = (uint8_t*)area;
+    *(uint16_t*)(p + 0)  = 0x037F;
+    *(uint32_t*)(p + 24) = 0x1F80;
+    if (fpu_save_mode != FPU_SAVE_FXSAVE)
+        *(uint64_t*)(p + 512) = XFEATURE_X87 | XFEATURE_SSE;
+}
@@ -65,28 +65,23 @@ void sse_init(void) {
     cr4 |= (1 << 9);
     cr4 |= (1 << 10);
 
-    if (avx_supported()) {
-        uint32_t ecx;
-        asm volatile(
-            "mov $1, %%eax\n"
-            "cpuid\n"
-            "mov %%ecx, %0\n"
-            : "=r"(ecx)
-            :
-            : "eax", "ebx", "edx"
-        );
-        if (ecx & (1 << 27)) {
+    bool xsave = (cpuid_ecx & (1 << 26)) != 0;
+    if (xsave) cr4 |= (1 << 18);
+
+    asm volatile("mov %0, %%cr4" : : "r"(cr4));
+
+    if (xsave) {
+        uint32_t lo, hi;
+        asm volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        uint64_t xcr0 = ((uint64_t)hi << 32) | lo;
+        xcr0 |= (1 << 0) | (1 << 1);
+        if (avx_supported()) {
             serial_writestring("[SSE] AVX supported, enabling...\n");
-            cr4 |= (1 << 18);
-            uint64_t xcr0;
-            asm volatile("xgetbv" : "=a"(xcr0) : "c"(0) : "edx");
-            xcr0 |= (1 << 1) | (1 << 2);
-            asm volatile("xsetbv" : : "c"(0), "a"(xcr0), "d"(xcr0 >> 32));
+            xcr0 |= (1 << 2);
         }
+        asm volatile("xsetbv" : : "c"(0), "a"((uint32_t)xcr0), "d"((uint32_t)(xcr0 >> 32)));
     }
 
-    asm volatile("mov %0, %%cr4" : : "r"(cr4));
-
     sse_set_mxcsr(MXCSR_DEFAULT);
 
     serial_writestring("[SSE] SSE initialized successfully\n");
@@ -4,6 +4,7 @@
 #include "../../include/acpi/acpi.h"
 #include "../../include/sched/sched.h"
 #include "../../include/sched/capabilities.h"
+#include "../../include/sched/futex.h"
 #include "../../include/smp/smp.h"
 #include "../../include/smp/percpu.h"
 #include "../../include/apic/apic.h"
@@ -41,14 +42,12 @@ static inline void wrmsr(uint32_t msr, uint64_t val) {
 }
 
 static inline task_t* cur_task(void) {
-    percpu_t* pc = get_percpu();
-    return pc ? (task_t*)pc->current_task : NULL;
+    return this_task();
 }
 
 static void save_user_regs(task_t* t) {
     if (!t) return;
-    percpu_t* pc = get_percpu();
-    if (!pc) return;
+    percpu_t* pc = this_cpu();
     t->user_rsp       = pc->syscall_user_rsp;
     t->user_saved_rip = pc->user_saved_rip;
     t->user_saved_rbp = pc->user_saved_rbp;
@@ -129,48 +128,157 @@ static int64_t sys_cap_drop(uint64_t mask) {
 
 static int64_t sys_task_info(uint64_t pid_arg, uint64_t buf_ptr) {
     if (!buf_ptr) return -EINVAL;
-    task_t* target = (pid_arg==0)?cur_task():task_find_by_pid((uint32_t)pid_arg);
-    if (!target) return -ESRCH;
     task_t* me = cur_task();
-    if (me && me!=target && !cap_has(me->capabilities,CAP_TASK_INFO)) return -EPERM;
+    uint64_t rf = rcu_read_lock();
+    task_t* target = (pid_arg==0)?me:task_find_by_pid((uint32_t)pid_arg);
+    if (!target) { rcu_read_unlock(rf); return -ESRCH; }
+    if (me && me!=target && !cap_has(me->capabilities,CAP_TASK_INFO)) { rcu_read_unlock(rf); return -EPERM; }
     cervus_task_info_t info; memset(&info,0,sizeof(info));
     info.pid=target->pid; info.ppid=target->ppid;
     info.uid=target->uid; info.gid=target->gid;
     info.capabilities=target->capabilities;
     info.state=(uint32_t)target->state; info.priority=(uint32_t)target->priority;
     info.total_runtime_ns=target->total_runtime;
+    info.nvcsw=target->nvcsw; info.nivcsw=target->nivcsw;
+    info.wait_time_ns=target->wait_time_ns;
+    info.nr_migrations=target->nr_migrations; info.last_cpu=target->last_cpu;
     strncpy(info.name,target->name,sizeof(info.name)-1);
+    rcu_read_unlock(rf);
     return copy_to_user((void*)buf_ptr,&info,sizeof(info));
 }
 
 static int64_t sys_task_kill(uint64_t pid_arg) {
     task_t*me=cur_task();
+    uint64_t rf=rcu_read_lock();
     task_t*target=task_find_by_pid((uint32_t)pid_arg);
-    if (!target) return -ESRCH;
+    if (!target) { rcu_read_unlock(rf); return -ESRCH; }
     bool own=(target->ppid==(me?me->pid:0));
-    if (!own && !cap_has(me?me->capabilities:0,CAP_KILL_ANY)) return -EPERM;
-    task_kill(target); return 0;
+    if (!own && !cap_has(me?me->capabilities:0,CAP_KILL_ANY)) { rcu_read_unlock(rf); return -EPERM; }
+    task_kill(target);
+    rcu_read_unlock(rf);
+    return 0;
+}
+
+static int64_t sys_sched_setaffinity(uint64_t pid_arg, uint64_t mask) {
+    task_t*me=cur_task();
+    if (!me || !cap_has(me->capabilities,CAP_SET_PRIO)) return -EPERM;
+    uint64_t rf=rcu_read_lock();
+    task_t*target=(pid_arg==0)?me:task_find_by_pid((uint32_t)pid_arg);
+    if (!target) { rcu_read_unlock(rf); return -ESRCH; }
+    if (target->pid==0 || target->is_userspace==TASK_TYPE_KERNEL) { rcu_read_unlock(rf); return -EPERM; }
+    if (target->uid!=me->uid && me->uid!=UID_ROOT) { rcu_read_unlock(rf); return -EPERM; }
+    int r=sched_set_affinity(target,mask);
+    rcu_read_unlock(rf);
+    if (r==-2) return -EBUSY;
+    if (r<0) return -EINVAL;
+    serial_printf("[SYSCALL] setaffinity: pid=%llu mask=0x%llx\n",pid_arg,mask);
+    return 0;
+}
+
+static int64_t sys_sched_getaffinity(uint64_t pid_arg, uint64_t mask_ptr) {
+    if (!mask_ptr) return -EINVAL;
+    task_t*me=cur_task();
+    uint64_t rf=rcu_read_lock();
+    task_t*target=(pid_arg==0)?me:task_find_by_pid((uint32_t)pid_arg);
+    if (!target) { rcu_read_unlock(rf); return -ESRCH; }
+    if (me && me!=target && !cap_has(me->capabilities,CAP_TASK_INFO)) { rcu_read_unlock(rf); return -EPERM; }
+    uint64_t mask=target->cpu_affinity?target->cpu_affinity:sched_online_mask();
+    rcu_read_unlock(rf);
+    return copy_to_user((void*)mask_ptr,&mask,sizeof(mask));
+}
+
+_Static_assert(SCHED_OTHER == SCHED_CLASS_FAIR && SCHED_FIFO == SCHED_CLASS_FIFO &&
+               SCHED_RR == SCHED_CLASS_RR, "sched policy numbers must match classes");
+
+static int64_t sys_sched_setscheduler(uint64_t pid_arg, uint64_t policy, uint64_t prio) {
+    task_t*me=cur_task(); if(!me) return -ESRCH;
+    if (policy!=SCHED_OTHER && policy!=SCHED_FIFO && policy!=SCHED_RR) return -EINVAL;
+    if (prio>MAX_PRIORITY) return -EINVAL;
+    uint64_t rf=rcu_read_lock();
+    task_t*target=(pid_arg==0)?me:task_find_by_pid((uint32_t)pid_arg);
+    if (!target) { rcu_read_unlock(rf); return -ESRCH; }
+    if (target->pid==0 || target->is_userspace==TASK_TYPE_KERNEL) { rcu_read_unlock(rf); return -EPERM; }
+    if (target->uid!=me->uid && me->uid!=UID_ROOT) { rcu_read_unlock(rf); return -EPERM; }
+    bool lowering=(target==me && policy==SCHED_OTHER && (int)prio<=me->priority);
+    if (!lowering && !cap_has(me->capabilities,CAP_SET_PRIO)) { rcu_read_unlock(rf); return -EPERM; }
+    int r=sched_set_class(target,(int)policy,(int)prio);
+    rcu_read_unlock(rf);
+    if (r==-2) return -EBUSY;
+    if (r<0) return -EINVAL;
+    serial_printf("[SYSCALL] setscheduler: pid=%llu policy=%llu prio=%llu\n",pid_arg,policy,prio);
+    return 0;
+}
+
+static int64_t sys_sched_getscheduler(uint64_t pid_arg) {
+    task_t*me=cur_task();
+    uint64_t rf=rcu_read_lock();
+    task_t*target=(pid_arg==0)?me:task_find_by_pid((uint32_t)pid_arg);
+    int64_t cls=target?(int64_t)target->sched_class:-ESRCH;
+    rcu_read_unlock(rf);
+    return cls;
 }
 
 static int64_t sys_fork(void) {
     task_t*parent=cur_task(); if(!parent) return -ESRCH;
-    save_user_regs(parent);
     task_t*child=task_fork(parent); if(!child) return -ENOMEM;
     serial_printf("[SYSCALL] fork: parent pid=%u → child pid=%u\n",
                   parent->pid,child->pid);
     return (int64_t)child->pid;
 }
 
+static int64_t sys_clone(uint64_t flags, uint64_t stack, uint64_t tls) {
+    task_t*parent=cur_task(); if(!parent) return -ESRCH;
+    if ((flags & CLONE_THREAD) && !(flags & CLONE_VM)) return -EINVAL;
+    if (stack && !uptr_validate((void*)(stack-8),8)) return -EFAULT;
+    task_t*child=task_clone(parent,flags,stack,tls); if(!child) return -ENOMEM;
+    serial_printf("[SYSCALL] clone: parent pid=%u → child pid=%u flags=0x%llx\n",
+                  parent->pid,child->pid,flags);
+    uint32_t pid=child->pid;
+    if (flags & CLONE_VFORK) task_vfork_wait(parent,child);
+    return (int64_t)pid;
+}
+
+static int64_t sys_vfork(uint64_t ret_addr) {
+    task_t*parent=cur_task(); if(!parent) return -ESRCH;
+    if (!uptr_validate((void*)ret_addr,1)) return -EFAULT;
+    uint64_t rip=parent->user_saved_rip, rsp=parent->user_rsp;
+    parent->user_saved_rip=ret_addr;
+    parent->user_rsp=rsp+8;
+    task_t*child=task_clone(parent,CLONE_VM|CLONE_VFORK,0,0);
+    if(!child){ parent->user_saved_rip=rip; parent->user_rsp=rsp; return -ENOMEM; }
+    uint32_t pid=child->pid;
+    task_vfork_wait(parent,child);
+    return (int64_t)pid;
+}
+
+static int64_t sys_set_tls(uint64_t base) {
+    task_t*me=cur_task(); if(!me) return -ESRCH;
+    if (base >= 0x0000800000000000ULL) return -EINVAL;
+    task_set_fs_base(me,base);
+    return 0;
+}
+
 static int64_t sys_yield(void) { task_yield(); return 0; }
 
+static int64_t sys_futex_wait(uint64_t uaddr, uint64_t val, uint64_t timeout_ns) {
+    if (!uptr_validate((void*)uaddr,sizeof(uint32_t))) return -EFAULT;
+    return futex_wait((uintptr_t)uaddr,(uint32_t)val,timeout_ns);
+}
+
+static int64_t sys_futex_wake(uint64_t uaddr, uint64_t nr) {
+    if (!uptr_validate((void*)uaddr,sizeof(uint32_t))) return -EFAULT;
+    return futex_wake((uintptr_t)uaddr,(uint32_t)nr);
+}
+
 static int64_t sys_wait(uint64_t pid_arg, uint64_t status_ptr, uint64_t flags) {
     task_t*parent=cur_task(); if(!parent) return -ESRCH;
-retry:;
+    wait_entry_t wait = {0};
     task_t*zombie=NULL;
-    {
+    for (;;) {
+        wait_prepare(&parent->child_wq, &wait);
+
         uint64_t _cf = spinlock_acquire_irqsave(&children_lock);
         task_t*child=parent->children;
-        bool has_children = (child != NULL);
         while (child) {
             bool match=(pid_arg==(uint64_t)-1)||(child->pid==(uint32_t)pid_arg);
             if (match && child->state==TASK_ZOMBIE) { zombie=child; break; }
@@ -178,21 +286,20 @@ retry:;
         }
         spinlock_release_irqrestore(&children_lock, _cf);
 
-        (void)has_children;
-    }
+        if (zombie || (flags & WNOHANG) || parent->pending_kill) break;
 
-    if (!zombie) {
-        if (flags & WNOHANG) return 0;
-        save_user_regs(parent);
         parent->wait_for_pid=(pid_arg==(uint64_t)-1)?(uint32_t)-1:(uint32_t)pid_arg;
-        parent->runnable=false; parent->state=TASK_BLOCKED;
         if (pid_arg != (uint64_t)-1)
             task_set_foreground((uint32_t)pid_arg);
 
         serial_printf("[WAIT] pid=%u blocking: user_rsp=0x%llx task_rsp=0x%llx\n",
                       parent->pid,parent->user_rsp,parent->rsp);
-        sched_reschedule(); goto retry;
+        wait_sleep(&wait);
     }
+    wait_finish(&parent->child_wq, &wait);
+    parent->wait_for_pid=0;
+
+    if (!zombie) return parent->pending_kill ? -EINTR : 0;
 
     if (status_ptr) {
         int status=(zombie->exit_code&0xFF)<<8;
@@ -321,51 +428,42 @@ static uintptr_t execve_build_stack(vmm_pagemap_t *map, uintptr_t stack_top, con
     return new_rsp;
 }
 
-static int64_t sys_execve(uint64_t path_ptr, uint64_t argv_ptr, uint64_t envp_ptr) {
-    (void)envp_ptr;
-    task_t *t = cur_task();
-    if (!t || !t->is_userspace) return -EPERM;
-
-    char kpath[EXECVE_MAX_PATH];
-    if (strncpy_from_user(kpath, (const char*)path_ptr, sizeof(kpath)) < 0) return -EFAULT;
-    if (!kpath[0]) return -ENOENT;
-    serial_printf("[EXECVE] pid=%u execve(\"%s\")\n", t->pid, kpath);
-
-    const char *kargv_ptrs[EXECVE_MAX_ARGS + 1];
-    char (*kargv_store)[EXECVE_MAX_ARGLEN] = malloc(EXECVE_MAX_ARGS * EXECVE_MAX_ARGLEN);
-    if (!kargv_store) return -ENOMEM;
+static int64_t execve_copy_argv(uint64_t argv_ptr, const char *kpath,
+                                char (*store)[EXECVE_MAX_ARGLEN], const char *ptrs[]) {
     int argc = 0;
-
     if (argv_ptr) {
         for (;;) {
-            if (argc >= EXECVE_MAX_ARGS) { free(kargv_store); return -E2BIG; }
+            if (argc >= EXECVE_MAX_ARGS) return -E2BIG;
             uint64_t uslot = argv_ptr + (uint64_t)argc * 8;
             uint64_t aptr  = 0;
-            if (copy_from_user(&aptr, (const void*)uslot, 8) < 0)
-                { free(kargv_store); return -EFAULT; }
+            if (copy_from_user(&aptr, (const void*)uslot, 8) < 0) return -EFAULT;
             if (!aptr) break;
-            if (strncpy_from_user(kargv_store[argc], (const char*)aptr, EXECVE_MAX_ARGLEN) < 0)
-                { free(kargv_store); return -EFAULT; }
-            kargv_ptrs[argc] = kargv_store[argc]; argc++;
+            if (strncpy_from_user(store[argc], (const char*)aptr, EXECVE_MAX_ARGLEN) < 0)
+                return -EFAULT;
+            ptrs[argc] = store[argc]; argc++;
         }
     }
-    kargv_ptrs[argc] = NULL;
+    ptrs[argc] = NULL;
     if (argc == 0) {
-        strncpy(kargv_store[0], kpath, EXECVE_MAX_ARGLEN-1);
-        kargv_store[0][EXECVE_MAX_ARGLEN-1] = '\0';
-        kargv_ptrs[0] = kargv_store[0]; kargv_ptrs[1] = NULL; argc = 1;
+        strncpy(store[0], kpath, EXECVE_MAX_ARGLEN-1);
+        store[0][EXECVE_MAX_ARGLEN-1] = '\0';
+        ptrs[0] = store[0]; ptrs[1] = NULL; argc = 1;
     }
+    return argc;
+}
 
+static int64_t execve_load_image(const char *kpath, const char *argv[], int argc,
+                                 elf_load_result_t *elf, uintptr_t *rsp_out) {
     vfs_file_t *vfile = NULL;
     int vret = vfs_open(kpath, O_RDONLY, 0, &vfile);
-    if (vret < 0) { serial_printf("[EXECVE] open failed: %d\n",vret); free(kargv_store); return (int64_t)vret; }
+    if (vret < 0) { serial_printf("[EXECVE] open failed: %d\n",vret); return (int64_t)vret; }
     vfs_stat_t st;
-    if (vfs_fstat(vfile,&st)<0 || st.st_size==0) { serial_printf("[EXECVE] fstat/size failed: path='%s' size=%llu\n", kpath, (unsigned long long)st.st_size); vfs_close(vfile); free(kargv_store); return -EIO; }
+    if (vfs_fstat(vfile,&st)<0 || st.st_size==0) { serial_printf("[EXECVE] fstat/size failed: path='%s' size=%llu\n", kpath, (unsigned long long)st.st_size); vfs_close(vfile); return -EIO; }
     size_t fsize = (size_t)st.st_size;
     uint8_t *elf_data = malloc(fsize);
-    if (!elf_data) { serial_printf("[EXECVE] malloc(%zu) failed for path='%s'\n", fsize, kpath); vfs_close(vfile); free(kargv_store); return -ENOMEM; }
+    if (!elf_data) { serial_printf("[EXECVE] malloc(%zu) failed for path='%s'\n", fsize, kpath); vfs_close(vfile); return -ENOMEM; }
     int64_t nr = vfs_read(vfile, elf_data, fsize); vfs_close(vfile);
-    if (nr<0 || (size_t)nr!=fsize) { serial_printf("[EXECVE] read failed: path='%s' expected=%zu got=%lld\n", kpath, fsize, (long long)nr); free(elf_data); free(kargv_store); return -EIO; }
+    if (nr<0 || (size_t)nr!=fsize) { serial_printf("[EXECVE] read failed: path='%s' expected=%zu got=%lld\n", kpath, fsize, (long long)nr); free(elf_data); return -EIO; }
     if (fsize < 4 || elf_data[0] != 0x7F || elf_data[1] != 'E' || elf_data[2] != 'L' || elf_data[3] != 'F') {
         serial_printf("[EXECVE] not an ELF: path='%s' magic=%02x%02x%02x%02x\n",
             kpath,
@@ -373,19 +471,44 @@ static int64_t sys_execve(uint64_t path_ptr, uint64_t argv_ptr, uint64_t envp_pt
             fsize > 1 ? elf_data[1] : 0,
             fsize > 2 ? elf_data[2] : 0,
             fsize > 3 ? elf_data[3] : 0);
-        free(elf_data); free(kargv_store); return -ENOEXEC;
+        free(elf_data); return -ENOEXEC;
     }
 
-    elf_load_result_t elf = elf_load(elf_data, fsize, 0); free(elf_data);
-    if (elf.error != ELF_OK) {
-        serial_printf("[EXECVE] elf_load: %s\n",elf_strerror(elf.error));
-        if (elf.pagemap) vmm_free_pagemap(elf.pagemap);
-        free(kargv_store); return -ENOEXEC;
+    *elf = elf_load(elf_data, fsize, 0); free(elf_data);
+    if (elf->error != ELF_OK) {
+        serial_printf("[EXECVE] elf_load: %s\n",elf_strerror(elf->error));
+        if (elf->pagemap) vmm_free_pagemap(elf->pagemap);
+        return -ENOEXEC;
     }
 
-    uintptr_t new_rsp = execve_build_stack(elf.pagemap, elf.stack_top, kargv_ptrs, argc, &elf);
+    uintptr_t new_rsp = execve_build_stack(elf->pagemap, elf->stack_top, argv, argc, elf);
+    if (!new_rsp) { vmm_free_pagemap(elf->pagemap); return -ENOMEM; }
+    elf->pagemap->brk_start = elf->pagemap->brk_current = elf->load_end;
+    *rsp_out = new_rsp;
+    return 0;
+}
+
+static int64_t sys_execve(uint64_t path_ptr, uint64_t argv_ptr, uint64_t envp_ptr) {
+    (void)envp_ptr;
+    task_t *t = cur_task();
+    if (!t || !t->is_userspace) return -EPERM;
+
+    char kpath[EXECVE_MAX_PATH];
+    if (strncpy_from_user(kpath, (const char*)path_ptr, sizeof(kpath)) < 0) return -EFAULT;
+    if (!kpath[0]) return -ENOENT;
+    serial_printf("[EXECVE] pid=%u execve(\"%s\")\n", t->pid, kpath);
+
+    const char *kargv_ptrs[EXECVE_MAX_ARGS + 1];
+    char (*kargv_store)[EXECVE_MAX_ARGLEN] = malloc(EXECVE_MAX_ARGS * EXECVE_MAX_ARGLEN);
+    if (!kargv_store) return -ENOMEM;
+    int64_t argc = execve_copy_argv(argv_ptr, kpath, kargv_store, kargv_ptrs);
+    if (argc < 0) { free(kargv_store); return argc; }
+
+    elf_load_result_t elf;
+    uintptr_t new_rsp = 0;
+    int64_t lr = execve_load_image(kpath, kargv_ptrs, (int)argc, &elf, &new_rsp);
     free(kargv_store);
-    if (!new_rsp) { vmm_free_pagemap(elf.pagemap); return -ENOMEM; }
+    if (lr < 0) return lr;
 
     if (t->fd_table) fd_table_cloexec(t->fd_table);
 
@@ -398,8 +521,7 @@ static int64_t sys_execve(uint64_t path_ptr, uint64_t argv_ptr, uint64_t envp_pt
     t->cr3        = (uint64_t)pmm_virt_to_phys(elf.pagemap->pml4);
     t->flags     |= TASK_FLAG_OWN_PAGEMAP;
     t->flags     &= ~TASK_FLAG_FORK;
-    t->brk_start = t->brk_current = elf.load_end;
-    t->brk_max   = 0x0000700000000000ULL;
+    task_set_fs_base(t, 0);
 
     t->user_rsp       = new_rsp;
     t->user_saved_rip = elf.entry;
@@ -411,18 +533,9 @@ static int64_t sys_execve(uint64_t path_ptr, uint64_t argv_ptr, uint64_t envp_pt
     for (const char *p=kpath;*p;p++) if (*p=='/') bn=p+1;
     strncpy(t->name, bn, sizeof(t->name)-1); t->name[sizeof(t->name)-1]='\0';
 
-    percpu_t *pc = get_percpu();
-    if (pc) {
-        pc->syscall_user_rsp = new_rsp;
-        pc->user_saved_rip   = elf.entry;
-        pc->user_saved_rbp = pc->user_saved_rbx = 0;
-        pc->user_saved_r12 = pc->user_saved_r13 = pc->user_saved_r14 = 0;
-        pc->user_saved_r15 = 0;
-        pc->user_saved_r11 = 0x200;
-    }
-
     if (old_pagemap && (old_flags & (TASK_FLAG_OWN_PAGEMAP|TASK_FLAG_FORK)))
-        vmm_free_pagemap(old_pagemap);
+        vmm_pagemap_put(old_pagemap);
+    task_vfork_done(t);
 
     asm volatile("lock addl $0, (%%rsp)" ::: "memory", "cc");
     vmm_switch_pagemap(t->pagemap);
@@ -431,6 +544,52 @@ static int64_t sys_execve(uint64_t path_ptr, uint64_t argv_ptr, uint64_t envp_pt
     return 0;
 }
 
+static int64_t sys_task_spawn(uint64_t path_ptr, uint64_t argv_ptr,
+                              uint64_t actions_ptr, uint64_t nactions) {
+    task_t *parent = cur_task();
+    if (!parent || !parent->is_userspace) return -EPERM;
+    if (nactions > SPAWN_MAX_ACTIONS) return -EINVAL;
+
+    cervus_spawn_action_t acts[SPAWN_MAX_ACTIONS];
+    if (nactions && copy_from_user(acts, (const void*)actions_ptr, nactions * sizeof(acts[0])) < 0)
+        return -EFAULT;
+
+    char kpath[EXECVE_MAX_PATH];
+    if (strncpy_from_user(kpath, (const char*)path_ptr, sizeof(kpath)) < 0) return -EFAULT;
+    if (!kpath[0]) return -ENOENT;
+
+    const char *kargv_ptrs[EXECVE_MAX_ARGS + 1];
+    char (*kargv_store)[EXECVE_MAX_ARGLEN] = malloc(EXECVE_MAX_ARGS * EXECVE_MAX_ARGLEN);
+    if (!kargv_store) return -ENOMEM;
+    int64_t argc = execve_copy_argv(argv_ptr, kpath, kargv_store, kargv_ptrs);
+    if (argc < 0) { free(kargv_store); return argc; }
+
+    elf_load_result_t elf;
+    uintptr_t new_rsp = 0;
+    int64_t lr = execve_load_image(kpath, kargv_ptrs, (int)argc, &elf, &new_rsp);
+    free(kargv_store);
+    if (lr < 0) return lr;
+
+    fd_table_t *fdt = parent->fd_table ? fd_table_clone(parent->fd_table) : fd_table_create();
+    if (!fdt) { vmm_free_pagemap(elf.pagemap); return -ENOMEM; }
+    for (uint64_t i = 0; i < nactions; i++) {
+        int r;
+        switch (acts[i].op) {
+        case SPAWN_ACTION_DUP2:  r = fd_dup2(fdt, acts[i].fd, acts[i].newfd); break;
+        case SPAWN_ACTION_CLOSE: r = fd_close(fdt, acts[i].fd); break;
+        default:                 r = -EINVAL; break;
+        }
+        if (r < 0) { fd_table_destroy(fdt); vmm_free_pagemap(elf.pagemap); return r; }
+    }
+    fd_table_cloexec(fdt);
+
+    const char *bn = kpath;
+    for (const char *p=kpath;*p;p++) if (*p=='/') bn=p+1;
+    task_t *child = task_spawn(parent, bn, elf.entry, new_rsp, elf.pagemap, fdt);
+    if (!child) { fd_table_destroy(fdt); vmm_free_pagemap(elf.pagemap); return -ENOMEM; }
+    return (int64_t)child->pid;
+}
+
 static int64_t sys_write(uint64_t fd, uint64_t buf_ptr, uint64_t count) {
     if (count == 0) return 0;
     if (count > 4096) count = 4096;
@@ -442,8 +601,11 @@ static int64_t sys_write(uint64_t fd, uint64_t buf_ptr, uint64_t count) {
     task_t *t = cur_task();
     if (t && t->fd_table) {
         vfs_file_t *file = fd_get(t->fd_table, (int)fd);
-        if (file)
-            return vfs_write(file, kbuf, count);
+        if (file) {
+            int64_t r = vfs_write(file, kbuf, count);
+            vfs_file_free(file);
+            return r;
+        }
     }
 
     if (fd != 1 && fd != 2) return -EBADF;
@@ -502,6 +664,7 @@ static int64_t sys_read(uint64_t fd, uint64_t buf_ptr, uint64_t count) {
     char kbuf[4096];
     size_t chunk = count > 4096 ? 4096 : count;
     int64_t r = vfs_read(file, kbuf, chunk);
+    vfs_file_free(file);
     if (r <= 0) return r;
     memcpy((void*)buf_ptr, kbuf, (size_t)r);
     return r;
@@ -536,7 +699,9 @@ static int64_t sys_seek(uint64_t fd, uint64_t offset, uint64_t whence) {
     if (!t || !t->fd_table) return -EBADF;
     vfs_file_t *f = fd_get(t->fd_table, (int)fd);
     if (!f) return -EBADF;
-    return vfs_seek(f, (int64_t)offset, (int)whence);
+    int64_t r = vfs_seek(f, (int64_t)offset, (int)whence);
+    vfs_file_free(f);
+    return r;
 }
 
 static int64_t sys_stat(uint64_t path_ptr, uint64_t stat_ptr) {
@@ -557,6 +722,7 @@ static int64_t sys_fstat(uint64_t fd, uint64_t stat_ptr) {
     if (!f) return -EBADF;
     vfs_stat_t st;
     int r = vfs_fstat(f, &st);
+    vfs_file_free(f);
     if (r < 0) return (int64_t)r;
     return copy_to_user((void*)stat_ptr, &st, sizeof(st));
 }
@@ -602,19 +768,24 @@ static int64_t sys_ioctl(uint64_t fd, uint64_t request, uint64_t arg_ptr) {
     if (arg_ptr) {
         size_t validate_sz = out_sz > in_sz ? out_sz : in_sz;
         if (validate_sz == 0) validate_sz = IOCTL_KBUF_MAX;
-        if (!uptr_validate((void *)arg_ptr, validate_sz))
+        if (!uptr_validate((void *)arg_ptr, validate_sz)) {
+            vfs_file_free(f);
             return -EFAULT;
+        }
     }
 
     char kbuf[IOCTL_KBUF_MAX];
     memset(kbuf, 0, sizeof(kbuf));
 
     if (arg_ptr && in_sz > 0) {
-        if (copy_from_user(kbuf, (const void *)arg_ptr, in_sz) < 0)
+        if (copy_from_user(kbuf, (const void *)arg_ptr, in_sz) < 0) {
+            vfs_file_free(f);
             return -EFAULT;
+        }
     }
 
     int64_t r = vfs_ioctl(f, request, arg_ptr ? (void *)kbuf : (void *)0);
+    vfs_file_free(f);
     if (r < 0) return r;
 
     if (arg_ptr && out_sz > 0) {
@@ -632,6 +803,7 @@ static int64_t sys_readdir(uint64_t fd, uint64_t dirent_ptr) {
     if (!f) return -EBADF;
     vfs_dirent_t kd;
     int r = vfs_readdir(f, &kd);
+    vfs_file_free(f);
     if (r < 0) return (int64_t)r;
     return copy_to_user((void*)dirent_ptr, &kd, sizeof(kd));
 }
@@ -641,12 +813,9 @@ static int64_t sys_dup(uint64_t fd) {
     if (!t || !t->fd_table) return -EBADF;
     vfs_file_t *f = fd_get(t->fd_table, (int)fd);
     if (!f) return -EBADF;
-    if (f->vnode && f->vnode->ops && f->vnode->ops->ref)
-        f->vnode->ops->ref(f->vnode);
     int nfd = fd_alloc(t->fd_table, f, 0);
     if (nfd < 0) {
-        if (f->vnode && f->vnode->ops && f->vnode->ops->unref)
-            f->vnode->ops->unref(f->vnode);
+        vfs_file_free(f);
         return -EMFILE;
     }
     return (int64_t)nfd;
@@ -665,8 +834,9 @@ typedef struct {
     char     buf[PIPE_BUFSZ];
     uint32_t head, tail;
     int      readers, writers;
-    uint32_t reader_waiting_pid;
     spinlock_t lock;
+    wait_queue_t read_wq;
+    wait_queue_t write_wq;
 } pipe_shared_t;
 
 typedef struct {
@@ -686,20 +856,19 @@ static int64_t pipe_read_op(vnode_t *n, void *buf, size_t len, uint64_t off) {
             if (got > 0) break;
 
             task_t *me = cur_task();
-            if (me) {
-                save_user_regs(me);
-                ps->reader_waiting_pid = me->pid;
-                me->runnable = false;
-                me->state    = TASK_BLOCKED;
-            }
-            sched_reschedule();
-            if (me) ps->reader_waiting_pid = 0;
-            if (me && me->pending_kill) return got > 0 ? (int64_t)got : -EINTR;
+            if (!me) break;
+            wait_entry_t wait = {0};
+            wait_prepare(&ps->read_wq, &wait);
+            if (ps->head == ps->tail && ps->writers > 0 && !me->pending_kill)
+                wait_sleep(&wait);
+            wait_finish(&ps->read_wq, &wait);
+            if (me->pending_kill) return -EINTR;
             continue;
         }
         dst[got++] = ps->buf[ps->head];
         ps->head = (ps->head + 1) % PIPE_BUFSZ;
     }
+    if (got > 0) wait_wake_all(&ps->write_wq);
     return (int64_t)got;
 }
 
@@ -711,29 +880,23 @@ static int64_t pipe_write_op(vnode_t *n, const void *buf, size_t len, uint64_t o
     const char *src = (const char*)buf;
     for (size_t i = 0; i < len; i++) {
         uint32_t next = (ps->tail + 1) % PIPE_BUFSZ;
-        int spins = 0;
         while (next == ps->head) {
             if (ps->readers == 0) return (i > 0) ? (int64_t)i : -EPIPE;
             task_t *me = cur_task();
-            if (me) save_user_regs(me);
-            task_yield();
-            if (me && me->pending_kill) return (i > 0) ? (int64_t)i : -EINTR;
+            if (!me) return (i > 0) ? (int64_t)i : -EAGAIN;
+            wait_entry_t wait = {0};
+            wait_wake_all(&ps->read_wq);
+            wait_prepare(&ps->write_wq, &wait);
+            if (next == ps->head && ps->readers > 0 && !me->pending_kill)
+                wait_sleep(&wait);
+            wait_finish(&ps->write_wq, &wait);
+            if (me->pending_kill) return (i > 0) ? (int64_t)i : -EINTR;
             next = (ps->tail + 1) % PIPE_BUFSZ;
-            spins++;
-            if (spins > 10000) break;
-        }
-        if (next == ps->head) {
-            return (i > 0) ? (int64_t)i : -EAGAIN;
         }
         ps->buf[ps->tail] = src[i];
         ps->tail = next;
-        if (ps->reader_waiting_pid) {
-            task_t *reader = task_find_by_pid(ps->reader_waiting_pid);
-            if (reader && !reader->runnable) {
-                task_unblock(reader);
-            }
-        }
     }
+    wait_wake_all(&ps->read_wq);
     return (int64_t)len;
 }
 
@@ -749,22 +912,18 @@ static void pipe_ref_op(vnode_t *n)   { (void)n; }
 static void pipe_unref_op(vnode_t *n) {
     pipe_vdata_t  *vd = (pipe_vdata_t*)n->fs_data;
     pipe_shared_t *ps = vd->shared;
-    if (vd->end == 0) ps->readers--;
-    else {
+    if (vd->end == 0) {
+        ps->readers--;
+        wait_wake_all(&ps->write_wq);
+    } else {
         ps->writers--;
-        if (ps->reader_waiting_pid) {
-            task_t *reader = task_find_by_pid(ps->reader_waiting_pid);
-            if (reader && !reader->runnable) {
-                task_unblock(reader);
-            }
-            ps->reader_waiting_pid = 0;
-        }
+        wait_wake_all(&ps->read_wq);
     }
 
     int r = ps->readers;
     int w = ps->writers;
 
-    free(vd); free(n);
+    free(vd); vnode_free(n);
 
     if (r <= 0 && w <= 0)
         free(ps);
@@ -793,15 +952,16 @@ static int64_t sys_pipe(uint64_t fds_ptr) {
     if (!ps) return -ENOMEM;
     memset(ps, 0, sizeof(*ps));
     ps->readers = 1; ps->writers = 1;
+    wait_queue_init(&ps->read_wq);
+    wait_queue_init(&ps->write_wq);
 
-    vnode_t    *rv = (vnode_t*)   malloc(sizeof(vnode_t));
-    vnode_t    *wv = (vnode_t*)   malloc(sizeof(vnode_t));
+    vnode_t    *rv = vnode_alloc();
+    vnode_t    *wv = vnode_alloc();
     pipe_vdata_t*rd = (pipe_vdata_t*)malloc(sizeof(pipe_vdata_t));
     pipe_vdata_t*wd = (pipe_vdata_t*)malloc(sizeof(pipe_vdata_t));
     if (!rv||!wv||!rd||!wd) {
-        free(ps);free(rv);free(wv);free(rd);free(wd); return -ENOMEM;
+        free(ps);vnode_free(rv);vnode_free(wv);free(rd);free(wd); return -ENOMEM;
     }
-    memset(rv,0,sizeof(*rv)); memset(wv,0,sizeof(*wv));
     rd->shared=ps; rd->end=0;
     wd->shared=ps; wd->end=1;
 
@@ -814,7 +974,7 @@ static int64_t sys_pipe(uint64_t fds_ptr) {
     vfs_file_t *rf = vfs_file_alloc();
     vfs_file_t *wf = vfs_file_alloc();
     if (!rf||!wf) {
-        free(ps);free(rv);free(wv);free(rd);free(wd);
+        free(ps);vnode_free(rv);vnode_free(wv);free(rd);free(wd);
         if(rf) vfs_file_free(rf);
         if(wf) vfs_file_free(wf);
         return -ENOMEM;
@@ -843,39 +1003,47 @@ static int64_t sys_fcntl(uint64_t fd, uint64_t cmd, uint64_t arg) {
     if (!t || !t->fd_table) return -EBADF;
     vfs_file_t *f = fd_get(t->fd_table, (int)fd);
     if (!f) return -EBADF;
+    int64_t r;
     switch (cmd) {
-        case F_GETFD: return (int64_t)fd_get_flags(t->fd_table,(int)fd);
-        case F_SETFD: return (int64_t)fd_set_flags(t->fd_table,(int)fd,(int)arg);
-        case F_GETFL: return (int64_t)f->flags;
-        case F_SETFL: f->flags=(f->flags & O_ACCMODE)|((int)arg & ~O_ACCMODE); return 0;
-        default: return -EINVAL;
+        case F_GETFD: r = (int64_t)fd_get_flags(t->fd_table,(int)fd); break;
+        case F_SETFD: r = (int64_t)fd_set_flags(t->fd_table,(int)fd,(int)arg); break;
+        case F_GETFL: r = (int64_t)f->flags; break;
+        case F_SETFL: f->flags=(f->flags & O_ACCMODE)|((int)arg & ~O_ACCMODE); r = 0; break;
+        default: r = -EINVAL; break;
     }
+    vfs_file_free(f);
+    return r;
 }
 
 static int64_t sys_brk(uint64_t new_brk) {
     task_t *t = cur_task();
     if (!t || !t->is_userspace) return -EINVAL;
-    if (!new_brk) return (int64_t)t->brk_current;
-    if (new_brk < t->brk_start || new_brk > t->brk_max) return (int64_t)t->brk_current;
+    vmm_pagemap_t *mm = t->pagemap;
+    spinlock_acquire(&mm->lock);
+    int64_t ret = (int64_t)mm->brk_current;
+    if (!new_brk || new_brk < mm->brk_start || new_brk > mm->brk_max) goto out;
 
-    uintptr_t old_brk  = t->brk_current;
+    uintptr_t old_brk  = mm->brk_current;
     uintptr_t old_page = (old_brk  + 0xFFFULL) & ~0xFFFULL;
     uintptr_t new_page = (new_brk  + 0xFFFULL) & ~0xFFFULL;
 
     if (new_brk > old_brk) {
         for (uintptr_t p = old_page; p < new_page; p += 0x1000) {
             void *ph = pmm_alloc_zero(1);
-            if (!ph) return (int64_t)t->brk_current;
-            if (!vmm_map_page(t->pagemap, p, pmm_virt_to_phys(ph),
+            if (!ph) goto out;
+            if (!vmm_map_page(mm, p, pmm_virt_to_phys(ph),
                               VMM_PRESENT|VMM_WRITE|VMM_USER|VMM_NOEXEC))
-                { pmm_free(ph,1); return (int64_t)t->brk_current; }
+                { pmm_free(ph,1); goto out; }
         }
     } else {
         for (uintptr_t p = new_page; p < old_page; p += 0x1000)
-            vmm_unmap_page(t->pagemap, p);
+            vmm_unmap_page(mm, p);
     }
-    t->brk_current = new_brk;
-    return (int64_t)new_brk;
+    mm->brk_current = new_brk;
+    ret = (int64_t)new_brk;
+out:
+    spinlock_release(&mm->lock);
+    return ret;
 }
 
 static int64_t sys_mmap(uint64_t hint, uint64_t length, uint64_t prot, uint64_t flags, uint64_t fd, uint64_t offset) {
@@ -890,7 +1058,12 @@ static int64_t sys_mmap(uint64_t hint, uint64_t length, uint64_t prot, uint64_t
     uintptr_t addr;
     if (flags & MAP_FIXED)       addr = hint & ~0xFFFULL;
     else if (hint)               addr = hint & ~0xFFFULL;
-    else { addr = (t->brk_max - (uint64_t)pages*0x1000) & ~0xFFFULL; t->brk_max = addr; }
+    else {
+        spinlock_acquire(&t->pagemap->lock);
+        addr = (t->pagemap->brk_max - (uint64_t)pages*0x1000) & ~0xFFFULL;
+        t->pagemap->brk_max = addr;
+        spinlock_release(&t->pagemap->lock);
+    }
 
     uint64_t vf = VMM_PRESENT|VMM_USER;
     if (prot & PROT_WRITE) vf |= VMM_WRITE;
@@ -945,14 +1118,11 @@ static int64_t sys_sleep_ns(uint64_t ns) {
     task_t *me = cur_task();
     if (!me) return -ESRCH;
 
-    save_user_regs(me);
 
     serial_printf("[SLEEP] pid=%u sleeping %llu ns\n", me->pid, ns);
 
-    uint64_t now = hpet_elapsed_ns();
-    me->wakeup_time_ns = now + ns;
-    me->runnable = false;
-    me->state    = TASK_BLOCKED;
+    task_block(me);
+    sched_sleep_until(me, hpet_elapsed_ns() + ns);
 
     sched_reschedule();
 
@@ -1137,8 +1307,12 @@ W0(sys_getpid)      W0(sys_getppid)
 W0(sys_getuid)      W0(sys_getgid)
 W1(sys_setuid)      W1(sys_setgid)
 W0(sys_fork)        W0(sys_yield)
+W3(sys_clone)       W1(sys_set_tls)     W1(sys_vfork)
+W3(sys_futex_wait)  W2(sys_futex_wake)
 W0(sys_cap_get)     W1(sys_cap_drop)
 W2(sys_task_info)   W1(sys_task_kill)
+W2(sys_sched_setaffinity) W2(sys_sched_getaffinity)
+W3(sys_sched_setscheduler) W1(sys_sched_getscheduler)
 W3(sys_read)        W3(sys_write)
 W3(sys_open)        W1(sys_close)
 W3(sys_seek)        W2(sys_stat)
@@ -1173,6 +1347,7 @@ extern int64_t sys_statvfs(uint64_t,uint64_t,uint64_t,uint64_t,uint64_t,uint64_t
 
 static int64_t _sys_execve(uint64_t a,uint64_t b,uint64_t c,uint64_t d,uint64_t e,uint64_t f){(void)d;(void)e;(void)f;return sys_execve(a,b,c);}
 static int64_t _sys_wait  (uint64_t a,uint64_t b,uint64_t c,uint64_t d,uint64_t e,uint64_t f){(void)d;(void)e;(void)f;return sys_wait(a,b,c);}
+static int64_t _sys_task_spawn(uint64_t a,uint64_t b,uint64_t c,uint64_t d,uint64_t e,uint64_t f){(void)e;(void)f;return sys_task_spawn(a,b,c,d);}
 
 static const syscall_fn_t syscall_table[SYSCALL_TABLE_SIZE] = {
     [SYS_EXIT]              = _sys_exit,
@@ -1184,12 +1359,18 @@ static const syscall_fn_t syscall_table[SYSCALL_TABLE_SIZE] = {
     [SYS_SETUID]            = _sys_setuid,
     [SYS_SETGID]            = _sys_setgid,
     [SYS_FORK]              = _sys_fork,
+    [SYS_CLONE]             = _sys_clone,
+    [SYS_SET_TLS]           = _sys_set_tls,
+    [SYS_VFORK]             = _sys_vfork,
+    [SYS_FUTEX_WAIT]        = _sys_futex_wait,
+    [SYS_FUTEX_WAKE]        = _sys_futex_wake,
     [SYS_EXECVE]            = _sys_execve,
     [SYS_WAIT]              = _sys_wait,
     [SYS_YIELD]             = _sys_yield,
     [SYS_CAP_GET]           = _sys_cap_get,
     [SYS_CAP_DROP]          = _sys_cap_drop,
     [SYS_TASK_INFO]         = _sys_task_info,
+    [SYS_TASK_SPAWN]        = _sys_task_spawn,
     [SYS_TASK_KILL]         = _sys_task_kill,
     [SYS_READ]              = _sys_read,
     [SYS_WRITE]             = _sys_write,
@@ -1232,6 +1413,10 @@ static const syscall_fn_t syscall_table[SYSCALL_TABLE_SIZE] = {
     [SYS_DISK_BIOS_INSTALL] = sys_disk_bios_install,
     [SYS_LIST_MOUNTS]       = sys_list_mounts,
     [SYS_STATVFS]           = sys_statvfs,
+    [SYS_SCHED_SETAFFINITY] = _sys_sched_setaffinity,
+    [SYS_SCHED_GETAFFINITY] = _sys_sched_getaffinity,
+    [SYS_SCHED_SETSCHEDULER] = _sys_sched_setscheduler,
+    [SYS_SCHED_GETSCHEDULER] = _sys_sched_getscheduler,
 };
 
 __attribute__((noreturn)) void sysret_bad_rip_panic(uint64_t bad_rip, uint64_t retval) {
@@ -1266,6 +1451,11 @@ int64_t syscall_handler_c(uint64_t nr, uint64_t a1, uint64_t a2, uint64_t a3, ui
     if (t) {
         save_user_regs(t);
     }
+    /* SFMASK entered us with IF=0 so the per-CPU scratch could not be
+     * clobbered by a nested syscall on this CPU; it now lives in the task,
+     * so let interrupts and preemption back in for the handler body. The
+     * asm exit path does its own cli before sysret. */
+    asm volatile("sti" ::: "memory");
     if (nr >= SYSCALL_TABLE_SIZE || !syscall_table[nr]) {
         serial_printf("[SYSCALL] unknown nr=%llu\n", nr);
         return -ENOSYS;
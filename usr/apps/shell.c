@@ -754,8 +754,8 @@ static int run_single(char *line) {
     }
     real_argv_buf[ri] = NULL;
 
-    pid_t child = fork();
-    if (child < 0) { fputs(C_RED "fork failed" C_RESET "\n", stdout); return 1; }
+    pid_t child = vfork();
+    if (child < 0) { fputs(C_RED "vfork failed" C_RESET "\n", stdout); return 1; }
     if (child == 0) {
         for (int i = 0; i < nredirs; i++) {
             int fd = -1;
@@ -774,13 +774,15 @@ static int run_single(char *line) {
                 fputs(C_RED "redirect: cannot open: " C_RESET, stdout);
                 fputs(redirs[i].path, stdout);
                 putchar('\n');
-                exit(1);
+                fflush(stdout);
+                _exit(1);
             }
             dup2(fd, target_fd);
             close(fd);
         }
         execve(binpath, (char *const *)real_argv_buf, NULL);
-        fputs(C_RED "exec failed: " C_RESET, stdout); fputs(binpath, stdout); putchar(10); exit(127);
+        fputs(C_RED "exec failed: " C_RESET, stdout); fputs(binpath, stdout); putchar(10);
+        fflush(stdout); _exit(127);
     }
     int status = 0;
     waitpid(child, &status, 0);
@@ -850,15 +852,16 @@ static int launch_installer(void) {
     argv[2] = "--cwd=/";
     argv[3] = NULL;
 
-    pid_t child = fork();
+    pid_t child = vfork();
     if (child < 0) {
-        fputs(C_RED "  fork failed\n" C_RESET, stdout);
+        fputs(C_RED "  vfork failed\n" C_RESET, stdout);
         return -1;
     }
     if (child == 0) {
         execve(path, (char *const *)argv, NULL);
         fputs(C_RED "  exec install-on-disk failed\n" C_RESET, stdout);
-        exit(127);
+        fflush(stdout);
+        _exit(127);
     }
     int status = 0;
     waitpid(child, &status, 0);
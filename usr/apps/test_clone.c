@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/cervus.h>
+
+static int failed = 0;
+static void ok(const char *s)   { printf("  [OK]  %s\n", s); }
+static void fail(const char *s) { printf("  [FAIL] %s\n", s); failed = 1; }
+
+#define CHILD_STACK_SIZE 16384
+
+static uint8_t child_stack[CHILD_STACK_SIZE] __attribute__((aligned(16)));
+
+static volatile int shared_value;
+static int          shared_fd = -1;
+
+static int wait_exit_code(pid_t pid)
+{
+    int status = 0;
+    if (waitpid(pid, &status, 0) != pid) return -1;
+    if (!WIFEXITED(status)) return -1;
+    return WEXITSTATUS(status);
+}
+
+static int vm_writer(void *arg)
+{
+    shared_value = (int)(intptr_t)arg;
+    return 5;
+}
+
+static int fd_closer(void *arg)
+{
+    (void)arg;
+    return close(shared_fd) == 0 ? 6 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc; (void)argv;
+    puts("--- test_clone ---");
+
+    shared_value = 0;
+    pid_t child = cervus_clone(CLONE_VM, child_stack + CHILD_STACK_SIZE,
+                               NULL, vm_writer, (void *)(intptr_t)123);
+    if (child > 0) ok("clone(CLONE_VM) returns child pid");
+    else { fail("clone(CLONE_VM) returns child pid"); return 1; }
+    int code = wait_exit_code(child);
+    if (code == 5) ok("clone child exit code 5");
+    else { printf("  exit code = %d\n", code); fail("clone child exit code 5"); }
+    if (shared_value == 123) ok("CLONE_VM child write visible to parent");
+    else fail("CLONE_VM child write visible to parent");
+
+    int p[2];
+    if (pipe(p) != 0) { fail("pipe for CLONE_FILES"); return 1; }
+    shared_fd = p[1];
+    child = cervus_clone(CLONE_VM | CLONE_FILES, child_stack + CHILD_STACK_SIZE,
+                         NULL, fd_closer, NULL);
+    if (child <= 0) { fail("clone(CLONE_VM|CLONE_FILES)"); close(p[0]); close(p[1]); return 1; }
+    code = wait_exit_code(child);
+    if (code == 6) ok("CLONE_FILES child close succeeds");
+    else { printf("  exit code = %d\n", code); fail("CLONE_FILES child close succeeds"); }
+    errno = 0;
+    if (write(p[1], "x", 1) < 0 && errno == EBADF) ok("CLONE_FILES close visible to parent");
+    else { fail("CLONE_FILES close visible to parent"); close(p[1]); }
+    close(p[0]);
+
+    if (pipe(p) != 0) { fail("pipe for private fd table"); return 1; }
+    shared_fd = p[1];
+    child = cervus_clone(CLONE_VM, child_stack + CHILD_STACK_SIZE, NULL, fd_closer, NULL);
+    if (child <= 0) { fail("clone(CLONE_VM) for private fd table"); close(p[0]); close(p[1]); return 1; }
+    code = wait_exit_code(child);
+    if (code == 6 && write(p[1], "x", 1) == 1) ok("without CLONE_FILES parent fd stays open");
+    else fail("without CLONE_FILES parent fd stays open");
+    close(p[0]); close(p[1]);
+
+    puts("--- test_clone done ---");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/cervus.h>
+
+static int failed = 0;
+static void ok(const char *s)   { printf("  [OK]  %s\n", s); }
+static void fail(const char *s) { printf("  [FAIL] %s\n", s); failed = 1; }
+
+#define CHILD_STACK_SIZE 16384
+/* Mirrors TASK_BLOCKED in the kernel's task_state_t. */
+#define TASK_STATE_BLOCKED 2
+
+static uint8_t child_stack[CHILD_STACK_SIZE] __attribute__((aligned(16)));
+
+static volatile uint32_t futex_word;
+static volatile int      futex_started;
+static volatile int      futex_ret;
+
+static int wait_exit_code(pid_t pid)
+{
+    int status = 0;
+    if (waitpid(pid, &status, 0) != pid) return -1;
+    if (!WIFEXITED(status)) return -1;
+    return WEXITSTATUS(status);
+}
+
+static int futex_waiter(void *arg)
+{
+    (void)arg;
+    futex_started = 1;
+    futex_ret = cervus_futex_wait(&futex_word, 0, 0);
+    return futex_word == 1 ? 7 : 1;
+}
+
+static int wait_until_blocked(pid_t pid)
+{
+    cervus_task_info_t info;
+    for (int i = 0; i < 1000; i++) {
+        if (cervus_task_info(pid, &info) == 0 && info.state == TASK_STATE_BLOCKED)
+            return 1;
+        cervus_nanosleep(1000000ULL);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc; (void)argv;
+    puts("--- test_futex ---");
+
+    futex_word = 0;
+    errno = 0;
+    int r = cervus_futex_wait(&futex_word, 1, 0);
+    if (r < 0 && errno == EAGAIN) ok("futex_wait on mismatched value returns EAGAIN");
+    else fail("futex_wait on mismatched value returns EAGAIN");
+
+    errno = 0;
+    uint64_t t0 = cervus_uptime_ns();
+    r = cervus_futex_wait(&futex_word, 0, 20000000ULL);
+    uint64_t dt = cervus_uptime_ns() - t0;
+    if (r < 0 && errno == ENOSYS) {
+        printf("  [SKIP] no timer for timed futex_wait\n");
+    } else {
+        if (r < 0 && errno == ETIMEDOUT) ok("futex_wait times out with ETIMEDOUT");
+        else { printf("  r=%d errno=%d\n", r, errno); fail("futex_wait times out with ETIMEDOUT"); }
+        if (dt >= 10000000ULL) ok("futex_wait timeout waits");
+        else { printf("  waited %llu ns\n", (unsigned long long)dt); fail("futex_wait timeout waits"); }
+    }
+
+    if (cervus_futex_wake(&futex_word, 1) == 0) ok("futex_wake with no waiters returns 0");
+    else fail("futex_wake with no waiters returns 0");
+
+    futex_started = 0;
+    futex_ret     = -2;
+    pid_t child = cervus_clone(CLONE_VM | CLONE_FILES, child_stack + CHILD_STACK_SIZE,
+                               NULL, futex_waiter, NULL);
+    if (child <= 0) { fail("clone futex waiter"); return 1; }
+    while (!futex_started) cervus_nanosleep(1000000ULL);
+    if (wait_until_blocked(child)) ok("futex waiter is asleep on the word");
+    else fail("futex waiter is asleep on the word");
+
+    futex_word = 1;
+    int woken = cervus_futex_wake(&futex_word, 1);
+    if (woken == 1) ok("futex_wake wakes the sleeping waiter");
+    else { printf("  woken = %d\n", woken); fail("futex_wake wakes the sleeping waiter"); }
+    woken = cervus_futex_wake(&futex_word, 1);
+    if (woken == 0) ok("second futex_wake finds no waiters");
+    else { printf("  woken = %d\n", woken); fail("second futex_wake finds no waiters"); }
+
+    int code = wait_exit_code(child);
+    if (code == 7) ok("futex waiter sees the new value and exits 7");
+    else { printf("  exit code = %d\n", code); fail("futex waiter exit code"); }
+    if (futex_ret == 0) ok("futex_wait returns 0 when woken");
+    else { printf("  futex_wait = %d\n", futex_ret); fail("futex_wait returns 0 when woken"); }
+
+    puts("--- test_futex done ---");
+    return failed ? 1 : 0;
+}
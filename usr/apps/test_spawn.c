@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/cervus.h>
+
+static int failed = 0;
+static void ok(const char *s)   { printf("  [OK]  %s\n", s); }
+static void fail(const char *s) { printf("  [FAIL] %s\n", s); failed = 1; }
+
+static int file_exists(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0;
+}
+
+static const char *resolve_app(const char *name, char *buf, size_t bufsz)
+{
+    const char *prefixes[] = { "/mnt/apps/", "/apps/", "/mnt/bin/", "/bin/", NULL };
+    for (int i = 0; prefixes[i]; i++) {
+        size_t pl = strlen(prefixes[i]);
+        size_t nl = strlen(name);
+        if (pl + nl + 1 > bufsz) continue;
+        memcpy(buf, prefixes[i], pl);
+        memcpy(buf + pl, name, nl + 1);
+        if (file_exists(buf)) return buf;
+    }
+    return NULL;
+}
+
+static int wait_exit_code(pid_t pid)
+{
+    int status = 0;
+    if (waitpid(pid, &status, 0) != pid) return -1;
+    if (!WIFEXITED(status)) return -1;
+    return WEXITSTATUS(status);
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc; (void)argv;
+    puts("--- test_spawn ---");
+
+    char target[256];
+    if (!resolve_app("execve_target", target, sizeof(target))) {
+        printf("  [SKIP] execve_target not found\n");
+        return 0;
+    }
+    char *const sargv[] = { target, (char *)"spawned", NULL };
+
+    int p[2];
+    if (pipe(p) != 0) { fail("pipe for spawn"); return 1; }
+    cervus_spawn_action_t acts[2] = {
+        { .op = SPAWN_ACTION_DUP2,  .fd = p[1], .newfd = 1 },
+        { .op = SPAWN_ACTION_CLOSE, .fd = p[0] },
+    };
+    pid_t child = cervus_task_spawn(target, sargv, acts, 2);
+    close(p[1]);
+    if (child > 0) ok("task_spawn returns child pid");
+    else { fail("task_spawn returns child pid"); close(p[0]); return 1; }
+
+    int code = wait_exit_code(child);
+    if (code == 99) ok("spawned child exit code 99");
+    else { printf("  exit code = %d\n", code); fail("spawned child exit code 99"); }
+
+    char buf[512];
+    size_t got = 0;
+    ssize_t r;
+    while (got < sizeof(buf) - 1 && (r = read(p[0], buf + got, sizeof(buf) - 1 - got)) > 0)
+        got += (size_t)r;
+    buf[got] = '\0';
+    close(p[0]);
+    if (strstr(buf, "execve_target: STARTED") && strstr(buf, "argv[1] = spawned"))
+        ok("dup2 action redirects child stdout");
+    else fail("dup2 action redirects child stdout");
+
+    cervus_spawn_action_t bad = { .op = SPAWN_ACTION_CLOSE, .fd = 200 };
+    errno = 0;
+    if (cervus_task_spawn(target, sargv, &bad, 1) < 0 && errno == EBADF)
+        ok("close action on bad fd fails with EBADF");
+    else fail("close action on bad fd fails with EBADF");
+
+    cervus_spawn_action_t many[SPAWN_MAX_ACTIONS + 1];
+    memset(many, 0, sizeof(many));
+    errno = 0;
+    if (cervus_task_spawn(target, sargv, many, SPAWN_MAX_ACTIONS + 1) < 0 && errno == EINVAL)
+        ok("too many actions fails with EINVAL");
+    else fail("too many actions fails with EINVAL");
+
+    if (cervus_task_spawn("/no/such/binary", sargv, NULL, 0) < 0)
+        ok("task_spawn of nonexistent path fails");
+    else fail("task_spawn of nonexistent path fails");
+
+    puts("--- test_spawn done ---");
+    return failed ? 1 : 0;
+}
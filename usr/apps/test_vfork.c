@@ -0,0 +1,40 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/cervus.h>
+
+static int failed = 0;
+static void ok(const char *s)   { printf("  [OK]  %s\n", s); }
+static void fail(const char *s) { printf("  [FAIL] %s\n", s); failed = 1; }
+
+static volatile int shared_value;
+
+static int wait_exit_code(pid_t pid)
+{
+    int status = 0;
+    if (waitpid(pid, &status, 0) != pid) return -1;
+    if (!WIFEXITED(status)) return -1;
+    return WEXITSTATUS(status);
+}
+
+int main(int argc, char **argv)
+{
+    (void)argc; (void)argv;
+    puts("--- test_vfork ---");
+
+    shared_value = 0;
+    pid_t child = vfork();
+    if (child < 0) { fail("vfork"); return 1; }
+    if (child == 0) {
+        shared_value = 77;
+        _exit(3);
+    }
+    if (shared_value == 77) ok("vfork parent resumes after child ran in shared VM");
+    else fail("vfork parent resumes after child ran in shared VM");
+    int code = wait_exit_code(child);
+    if (code == 3) ok("vfork child exit code 3");
+    else { printf("  exit code = %d\n", code); fail("vfork child exit code 3"); }
+
+    puts("--- test_vfork done ---");
+    return failed ? 1 : 0;
+}
@@ -130,6 +130,21 @@ int   setuid(uid_t u) { return (int)__sys_ret(syscall1(SYS_SETUID, u)); }
 int   setgid(gid_t g) { return (int)__sys_ret(syscall1(SYS_SETGID, g)); }
 pid_t fork(void)    { return (pid_t)__sys_ret(syscall0(SYS_FORK)); }
 
+#define __CERVUS_XSTR(x) #x
+#define __CERVUS_STR(x)  __CERVUS_XSTR(x)
+
+__attribute__((used)) static pid_t __cervus_vfork_fail(long r) { return (pid_t)__sys_ret(r); }
+
+__asm__(".global vfork\n"
+        ".type vfork, @function\n"
+        "vfork:\n"
+        "    mov (%rsp), %rdi\n"
+        "    mov $" __CERVUS_STR(SYS_VFORK) ", %eax\n"
+        "    syscall\n"
+        "    mov %rax, %rdi\n"
+        "    jmp __cervus_vfork_fail\n"
+        ".size vfork, . - vfork\n");
+
 int execve(const char *path, char *const argv[], char *const envp[])
 {
     char abs[CERVUS_PATH_MAX];
@@ -404,6 +419,46 @@ int      cervus_task_info(pid_t p, cervus_task_info_t *o)  { return (int)__sys_r
 int      cervus_task_kill(pid_t p)                         { return (int)__sys_ret(syscall1(SYS_TASK_KILL, p)); }
 uint64_t cervus_cap_get(void)                              { return (uint64_t)syscall0(SYS_CAP_GET); }
 int      cervus_cap_drop(uint64_t m)                       { return (int)__sys_ret(syscall1(SYS_CAP_DROP, m)); }
+int      cervus_sched_setaffinity(pid_t p, uint64_t m)     { return (int)__sys_ret(syscall2(SYS_SCHED_SETAFFINITY, p, m)); }
+int      cervus_sched_getaffinity(pid_t p, uint64_t *m)    { return (int)__sys_ret(syscall2(SYS_SCHED_GETAFFINITY, p, m)); }
+int      cervus_sched_setscheduler(pid_t p, int pol, int pr){ return (int)__sys_ret(syscall3(SYS_SCHED_SETSCHEDULER, p, pol, pr)); }
+int      cervus_sched_getscheduler(pid_t p)                { return (int)__sys_ret(syscall1(SYS_SCHED_GETSCHEDULER, p)); }
+int      cervus_set_tls(void *base)                        { return (int)__sys_ret(syscall1(SYS_SET_TLS, base)); }
+int      cervus_futex_wait(volatile uint32_t *a, uint32_t v, uint64_t ns)
+                                                           { return (int)__sys_ret(syscall3(SYS_FUTEX_WAIT, a, v, ns)); }
+int      cervus_futex_wake(volatile uint32_t *a, int n)    { return (int)__sys_ret(syscall2(SYS_FUTEX_WAKE, a, n)); }
+
+pid_t cervus_task_spawn(const char *path, char *const argv[],
+                        const cervus_spawn_action_t *actions, int nactions)
+{
+    char abs[CERVUS_PATH_MAX];
+    path = __cervus_resolve(path, abs, sizeof(abs));
+    return (pid_t)__sys_ret(syscall4(SYS_TASK_SPAWN, path, argv, actions, nactions));
+}
+
+pid_t cervus_clone(uint64_t flags, void *stack_top, void *tls, int (*fn)(void *), void *arg)
+{
+    uint64_t *sp = (uint64_t *)((uintptr_t)stack_top & ~(uintptr_t)0xF);
+    *--sp = (uint64_t)arg;
+    *--sp = (uint64_t)fn;
+    int64_t ret;
+    asm volatile ("syscall\n\t"
+                  "test %%rax, %%rax\n\t"
+                  "jnz 1f\n\t"
+                  "pop %%rax\n\t"
+                  "pop %%rdi\n\t"
+                  "call *%%rax\n\t"
+                  "mov %%rax, %%rdi\n\t"
+                  "mov %[nr_exit], %%eax\n\t"
+                  "syscall\n\t"
+                  "ud2\n"
+                  "1:"
+                  : "=a"(ret)
+                  : "0"((uint64_t)SYS_CLONE), "D"(flags), "S"(sp), "d"(tls),
+                    [nr_exit] "i"(SYS_EXIT)
+                  : "rcx", "r11", "memory");
+    return (pid_t)__sys_ret(ret);
+}
 
 int      cervus_meminfo(cervus_meminfo_t *m)               { return (int)__sys_ret(syscall1(SYS_MEMINFO, m)); }
 uint64_t cervus_uptime_ns(void)                            { return (uint64_t)syscall0(SYS_UPTIME); }
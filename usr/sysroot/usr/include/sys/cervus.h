@@ -49,8 +49,26 @@ typedef struct {
     uint32_t state;
     uint32_t priority;
     uint64_t total_runtime_ns;
+    uint64_t nvcsw;
+    uint64_t nivcsw;
+    uint64_t wait_time_ns;
+    uint32_t nr_migrations;
+    uint32_t last_cpu;
 } cervus_task_info_t;
 
+#define SCHED_EV_SWITCH   1
+#define SCHED_EV_WAKEUP   2
+#define SCHED_EV_MIGRATE  3
+
+typedef struct {
+    uint64_t tsc;
+    uint32_t pid;
+    uint32_t arg;
+    uint16_t type;
+    uint16_t cpu;
+    uint32_t arg2;
+} cervus_sched_event_t;
+
 typedef struct {
     uint64_t total_bytes;
     uint64_t free_bytes;
@@ -59,6 +77,13 @@ typedef struct {
     uint64_t page_size;
 } cervus_meminfo_t;
 
+typedef struct {
+    int32_t op;
+    int32_t fd;
+    int32_t newfd;
+    int32_t _pad;
+} cervus_spawn_action_t;
+
 typedef struct {
     int64_t tv_sec;
     int64_t tv_nsec;
@@ -86,13 +111,38 @@ typedef struct {
 #define CLOCK_MONOTONIC  1
 
 #define WNOHANG        0x1
+
+#define SCHED_OTHER    0
+#define SCHED_FIFO     1
+#define SCHED_RR       2
+
+#define CLONE_VM       0x00000100
+#define CLONE_FILES    0x00000400
+#define CLONE_VFORK    0x00004000
+#define CLONE_THREAD   0x00010000
+#define CLONE_SETTLS   0x00080000
+#define SPAWN_ACTION_DUP2   1
+#define SPAWN_ACTION_CLOSE  2
+#define SPAWN_MAX_ACTIONS   16
+
 #define WEXITSTATUS(s) (((s) >> 8) & 0xFF)
 #define WIFEXITED(s)   (((s) & 0x7F) == 0)
 
 int      cervus_task_info(pid_t pid, cervus_task_info_t *out);
 int      cervus_task_kill(pid_t pid);
+pid_t    cervus_task_spawn(const char *path, char *const argv[],
+                           const cervus_spawn_action_t *actions, int nactions);
 uint64_t cervus_cap_get(void);
 int      cervus_cap_drop(uint64_t mask);
+int      cervus_sched_setaffinity(pid_t pid, uint64_t mask);
+int      cervus_sched_getaffinity(pid_t pid, uint64_t *mask);
+int      cervus_sched_setscheduler(pid_t pid, int policy, int priority);
+int      cervus_sched_getscheduler(pid_t pid);
+pid_t    cervus_clone(uint64_t flags, void *stack_top, void *tls,
+                      int (*fn)(void *), void *arg);
+int      cervus_set_tls(void *base);
+int      cervus_futex_wait(volatile uint32_t *addr, uint32_t expected, uint64_t timeout_ns);
+int      cervus_futex_wake(volatile uint32_t *addr, int count);
 
 int      cervus_meminfo(cervus_meminfo_t *out);
 uint64_t cervus_uptime_ns(void);
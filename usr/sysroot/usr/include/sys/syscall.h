@@ -18,6 +18,9 @@
 #define SYS_CAP_DROP         12
 #define SYS_TASK_INFO        13
 #define SYS_EXECVE           14
+#define SYS_CLONE            15
+#define SYS_SET_TLS          16
+#define SYS_VFORK            17
 
 #define SYS_READ             20
 #define SYS_WRITE            21
@@ -47,6 +50,7 @@
 #define SYS_FUTEX_WAKE       81
 
 #define SYS_DBG_PRINT       512
+#define SYS_TASK_SPAWN      514
 #define SYS_TASK_KILL       515
 #define SYS_IOPORT_READ     521
 #define SYS_IOPORT_WRITE    522
@@ -72,6 +76,11 @@
 #define SYS_LIST_MOUNTS     546
 #define SYS_STATVFS         547
 
+#define SYS_SCHED_SETAFFINITY 548
+#define SYS_SCHED_GETAFFINITY 549
+#define SYS_SCHED_SETSCHEDULER 550
+#define SYS_SCHED_GETSCHEDULER 551
+
 static inline int64_t
 __syscall6(uint64_t nr, uint64_t a1, uint64_t a2, uint64_t a3,
            uint64_t a4, uint64_t a5, uint64_t a6)
@@ -41,6 +41,7 @@ gid_t   getgid(void);
 int     setuid(uid_t uid);
 int     setgid(gid_t gid);
 pid_t   fork(void);
+pid_t   vfork(void) __attribute__((returns_twice));
 int     execve(const char *path, char *const argv[], char *const envp[]);
 int     execv(const char *path, char *const argv[]);
 int     execvp(const char *file, char *const argv[]);